@@ -1,11 +1,40 @@
 TEMPLATE = app
 
-QT += qml quick bluetooth
+QT += qml quick bluetooth network
 CONFIG += c++11
 
+# heap allocation counters for BLEInterface --alloc-check (glibc)
+alloc_tracking {
+    DEFINES += BLE_ALLOC_TRACKING
+}
+
 SOURCES += main.cpp \
     deviceinfo.cpp \
+    devicemodel.cpp \
     ble.cpp \
+    dspengine.cpp \
+    linkpacer.cpp \
+    linkwatchdog.cpp \
+    blemetrics.cpp \
+    paramautomation.cpp \
+    paramschema.cpp \
+    eqbandmodel.cpp \
+    streamtransport.cpp \
+    devicestandin.cpp \
+    statecache.cpp \
+    renderprofiler.cpp \
+    outboundscheduler.cpp \
+    configsnapshot.cpp \
+    linkbringup.cpp \
+    requesttracker.cpp \
+    statehistory.cpp \
+    linkbroker.cpp \
+    batchprovisioner.cpp \
+    paramslider.cpp \
+    alloctracker.cpp \
+    roomanalyzer.cpp \
+    linkclock.cpp \
+    linksimulation.cpp \
 
 RESOURCES += qml.qrc
 
@@ -56,7 +85,32 @@ DISTFILES += \
 
 HEADERS += \
     deviceinfo.h \
-    ble.h
+    devicemodel.h \
+    ble.h \
+    dspengine.h \
+    simd4.h \
+    linkpacer.h \
+    linkwatchdog.h \
+    blemetrics.h \
+    paramautomation.h \
+    paramschema.h \
+    eqbandmodel.h \
+    streamtransport.h \
+    devicestandin.h \
+    statecache.h \
+    renderprofiler.h \
+    outboundscheduler.h \
+    configsnapshot.h \
+    linkbringup.h \
+    requesttracker.h \
+    statehistory.h \
+    linkbroker.h \
+    batchprovisioner.h \
+    paramslider.h \
+    alloctracker.h \
+    roomanalyzer.h \
+    linkclock.h \
+    linksimulation.h
 
 
 ANDROID_PACKAGE_SOURCE_DIR = $$PWD/android
@@ -85,7 +85,8 @@ Drawer {
 
                 value: ble.data_volume
 
-                onValueChangedByUser: ble.data_volume = value
+                target: ble
+                targetProperty: "data_volume"
             }
 
             Slider4 {
@@ -99,8 +100,9 @@ Drawer {
 
                 value: ble.data_bass/40
 
-                onValueChangedByUser: ble.data_bass = value*40
-
+                target: ble
+                targetProperty: "data_bass"
+                targetFactor: 40
             }
 
             Slider4 {
@@ -113,9 +115,8 @@ Drawer {
 
                 value: ble.data_middle
 
-                onValueChangedByUser: {
-                    ble.data_middle = value
-                }
+                target: ble
+                targetProperty: "data_middle"
             }
 
             Slider4 {
@@ -129,9 +130,9 @@ Drawer {
 
                 value: ble.data_treble/40
 
-                onValueChangedByUser: {
-                    ble.data_treble = value*40
-                }
+                target: ble
+                targetProperty: "data_treble"
+                targetFactor: 40
             }
         }
 }
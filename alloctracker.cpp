@@ -0,0 +1,181 @@
+#include "alloctracker.h"
+
+#include <stdlib.h>
+#include <errno.h>
+
+// plain TLS counters: safe to touch from inside malloc
+static thread_local quint64 t_allocations = 0;
+static thread_local quint64 t_excluded = 0;
+static thread_local int t_depth = 0;
+
+#if defined(BLE_ALLOC_TRACKING) && defined(__GLIBC__)
+#define ALLOC_INTERPOSED 1
+
+// Definitions in the executable take precedence over libc for every
+// library, Qt included; the real allocator stays reachable under __libc_*.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+
+void *malloc(size_t size) noexcept
+{
+    ++t_allocations;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) noexcept
+{
+    ++t_allocations;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) noexcept
+{
+    ++t_allocations;
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) noexcept
+{
+    ++t_allocations;
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) noexcept
+{
+    ++t_allocations;
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) noexcept
+{
+    ++t_allocations;
+    void *p = __libc_memalign(alignment, size);
+    if (!p)
+        return ENOMEM;
+    *ptr = p;
+    return 0;
+}
+
+void free(void *ptr) noexcept
+{
+    __libc_free(ptr);
+}
+}
+#endif
+
+// probes run on the GUI thread only
+struct PathStats
+{
+    quint64 events;
+    quint64 allocations;
+    quint64 excluded;
+    quint64 maxPerEvent;
+    quint64 allocatingEvents;
+};
+
+static PathStats s_stats[AllocTracker::PathCount];
+
+static const char *const pathNames[AllocTracker::PathCount] = {
+    "inbound", "outbound", "scan"
+};
+
+
+bool AllocTracker::available()
+{
+#ifdef ALLOC_INTERPOSED
+    return true;
+#else
+    return false;
+#endif
+}
+
+quint64 AllocTracker::allocations()
+{
+    return t_allocations;
+}
+
+void AllocTracker::record(Path path, quint64 allocations, quint64 excluded)
+{
+    PathStats &stats = s_stats[path];
+    stats.events++;
+    stats.allocations += allocations;
+    stats.excluded += excluded;
+    if (allocations)
+        stats.allocatingEvents++;
+    if (allocations > stats.maxPerEvent)
+        stats.maxPerEvent = allocations;
+}
+
+void AllocTracker::reset()
+{
+    for (int p = 0; p < PathCount; p++)
+        s_stats[p] = PathStats();
+}
+
+quint64 AllocTracker::events(Path path)
+{
+    return s_stats[path].events;
+}
+
+quint64 AllocTracker::allocations(Path path)
+{
+    return s_stats[path].allocations;
+}
+
+quint64 AllocTracker::maxPerEvent(Path path)
+{
+    return s_stats[path].maxPerEvent;
+}
+
+QByteArray AllocTracker::report()
+{
+    if (!available())
+        return "allocation tracking not built in (qmake CONFIG+=alloc_tracking, glibc)\n";
+
+    QByteArray out = "path       events   allocs   per-event  max  allocating  platform\n";
+
+    for (int p = 0; p < PathCount; p++)
+    {
+        const PathStats &stats = s_stats[p];
+        const double perEvent = stats.events ? double(stats.allocations) / stats.events : 0.0;
+
+        char line[128];
+        qsnprintf(line, sizeof(line), "%-9s %7llu %8llu %11.3f %4llu %11llu %9llu\n", pathNames[p],
+                  (unsigned long long)stats.events, (unsigned long long)stats.allocations, perEvent,
+                  (unsigned long long)stats.maxPerEvent, (unsigned long long)stats.allocatingEvents,
+                  (unsigned long long)stats.excluded);
+        out += line;
+    }
+    return out;
+}
+
+//---------------------------------------------------//
+
+AllocProbe::AllocProbe(AllocTracker::Path path):
+    m_path(path), m_outer(t_depth++ == 0), m_start(t_allocations), m_excluded(t_excluded)
+{
+}
+
+AllocProbe::~AllocProbe()
+{
+    t_depth--;
+    if (!m_outer)
+        return;
+
+    const quint64 excluded = t_excluded - m_excluded;
+    AllocTracker::record(m_path, t_allocations - m_start - excluded, excluded);
+}
+
+AllocExclude::AllocExclude():
+    m_start(t_allocations)
+{
+}
+
+AllocExclude::~AllocExclude()
+{
+    t_excluded += t_allocations - m_start;
+}
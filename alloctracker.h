@@ -0,0 +1,75 @@
+#ifndef ALLOCTRACKER_H
+#define ALLOCTRACKER_H
+
+#include <QtGlobal>
+#include <QByteArray>
+
+// Heap allocation counts of the BLE event paths. Built with
+// CONFIG+=alloc_tracking (BLE_ALLOC_TRACKING, glibc only) malloc and friends
+// are interposed and counted per thread; ALLOC_PROBE() then records how many
+// allocations one inbound notification, outbound write or scan callback
+// made. Allocations inside ALLOC_EXCLUDE() (the platform write into the
+// socket or GATT stack) are reported separately. Without the flag the
+// macros compile to nothing.
+//
+// BLEInterface --alloc-check runs a session against an in-process stand-in
+// and fails if the steady state allocates.
+class AllocTracker
+{
+public:
+    enum Path {
+        Inbound,        // notification / frame handling
+        Outbound,       // control change, write slot, heartbeat
+        Scan,           // discovery callbacks
+        PathCount
+    };
+
+    static bool available();
+
+    // this thread, since start
+    static quint64 allocations();
+
+    static void record(Path path, quint64 allocations, quint64 excluded);
+    static void reset();
+
+    static quint64 events(Path path);
+    static quint64 allocations(Path path);
+    static quint64 maxPerEvent(Path path);
+
+    static QByteArray report();
+};
+
+// counts the allocations made on this thread while in scope; nested probes
+// add to the outermost one
+class AllocProbe
+{
+public:
+    explicit AllocProbe(AllocTracker::Path path);
+    ~AllocProbe();
+
+private:
+    AllocTracker::Path m_path;
+    bool m_outer;
+    quint64 m_start;
+    quint64 m_excluded;
+};
+
+class AllocExclude
+{
+public:
+    AllocExclude();
+    ~AllocExclude();
+
+private:
+    quint64 m_start;
+};
+
+#ifdef BLE_ALLOC_TRACKING
+#define ALLOC_PROBE(path) AllocProbe allocProbe(AllocTracker::path)
+#define ALLOC_EXCLUDE() AllocExclude allocExclude
+#else
+#define ALLOC_PROBE(path)
+#define ALLOC_EXCLUDE()
+#endif
+
+#endif // ALLOCTRACKER_H
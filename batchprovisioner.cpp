@@ -0,0 +1,483 @@
+#include "batchprovisioner.h"
+#include "ble.h"
+#include "devicemodel.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QTimer>
+#include <QStringList>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QBluetoothDeviceDiscoveryAgent>
+
+#define DEFAULT_PARALLEL 4
+#define DEFAULT_UNIT_TIMEOUT_S 90
+#define DEFAULT_DISCOVERY_TIMEOUT_S 120
+
+// configure + verify rounds per unit before it is failed
+#define MAX_CONFIGURE_ATTEMPTS 2
+
+#define VERIFY_TIMEOUT_MS 2000
+
+
+BatchProvisioner::BatchProvisioner(QObject *parent):
+    QObject(parent), m_parallel(DEFAULT_PARALLEL), m_unitTimeoutMs(DEFAULT_UNIT_TIMEOUT_S * 1000),
+    m_discoveryTimeoutMs(DEFAULT_DISCOVERY_TIMEOUT_S * 1000), m_agent(0), m_elapsedMs(0),
+    m_active(0), m_peakActive(0)
+{
+    m_discoveryTimer = new QTimer(this);
+    m_discoveryTimer->setSingleShot(true);
+    connect(m_discoveryTimer, SIGNAL(timeout()), this, SLOT(discoveryTimeout()));
+}
+
+BatchProvisioner::~BatchProvisioner()
+{
+    for (int i = 0; i < m_units.size(); i++)
+        delete m_units[i].ble;
+}
+
+bool BatchProvisioner::loadManifest(const QString &path, QString *error)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        if (error)
+            *error = file.errorString();
+        return false;
+    }
+
+    QJsonParseError parseError;
+    const QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &parseError);
+    if (!doc.isObject())
+    {
+        if (error)
+            *error = parseError.errorString();
+        return false;
+    }
+
+    const QJsonObject root = doc.object();
+    m_parallel = qMax(1, root.value("parallel").toInt(DEFAULT_PARALLEL));
+    m_unitTimeoutMs = root.value("unit_timeout_s").toInt(DEFAULT_UNIT_TIMEOUT_S) * 1000;
+    m_discoveryTimeoutMs = root.value("discovery_timeout_s").toInt(DEFAULT_DISCOVERY_TIMEOUT_S) * 1000;
+
+    const QJsonObject defaults = root.value("defaults").toObject();
+    const QJsonArray units = root.value("units").toArray();
+
+    m_units.clear();
+    for (int n = 0; n < units.size(); n++)
+    {
+        // unit keys override the defaults
+        QJsonObject entry = defaults;
+        const QJsonObject own = units.at(n).toObject();
+        for (QJsonObject::const_iterator it = own.begin(); it != own.end(); ++it)
+            entry.insert(it.key(), it.value());
+
+        Unit unit;
+        unit.address = entry.value("address").toString();
+        unit.label = entry.value("label").toString(unit.address);
+        unit.style = entry.value("style").toInt(-1);
+        unit.firmware = entry.value("firmware").toString();
+
+        if (unit.address.isEmpty())
+        {
+            if (error)
+                *error = QString("unit %1 has no address").arg(n);
+            return false;
+        }
+
+        for (int i = 0; i < ParamCount; i++)
+        {
+            const ParamSpec &spec = ParamSchema::params[i];
+            unit.hasTarget[i] = entry.contains(spec.name);
+            unit.target[i] = qBound(spec.minimum, entry.value(spec.name).toInt(), spec.maximum);
+            unit.readback[i] = -1;
+        }
+
+        unit.state = Pending;
+        unit.ble = 0;
+        unit.timer = 0;
+        unit.attempts = 0;
+        unit.readbackStyle = -1;
+        unit.discoveredMs = unit.connectMs = unit.readyMs = unit.finishedMs = -1;
+        m_units.append(unit);
+    }
+
+    return !m_units.isEmpty();
+}
+
+bool BatchProvisioner::isTransport(const QString &address)
+{
+    return address.contains("://") || address.startsWith("unix:") || address.startsWith("local:");
+}
+
+//---------------------------------------------------//
+
+void BatchProvisioner::start()
+{
+    m_clock.start();
+
+    bool scan = false;
+    for (int i = 0; i < m_units.size(); i++)
+    {
+        if (isTransport(m_units[i].address))
+        {
+            m_units[i].state = Discovered;
+            m_units[i].discoveredMs = 0;
+        }
+        else
+            scan = true;
+    }
+
+    // one scan for the whole batch, units are connected as they show up
+    if (scan)
+    {
+        m_agent = new QBluetoothDeviceDiscoveryAgent(this);
+        connect(m_agent, SIGNAL(deviceDiscovered(QBluetoothDeviceInfo)), this, SLOT(deviceDiscovered(QBluetoothDeviceInfo)));
+        connect(m_agent, SIGNAL(finished()), this, SLOT(scanFinished()));
+        m_agent->start();
+        m_discoveryTimer->start(m_discoveryTimeoutMs);
+    }
+
+    qWarning() << "Provisioning" << m_units.size() << "units," << m_parallel << "at a time";
+    pump();
+}
+
+void BatchProvisioner::deviceDiscovered(const QBluetoothDeviceInfo &info)
+{
+    if (!(info.coreConfigurations() & QBluetoothDeviceInfo::LowEnergyCoreConfiguration))
+        return;
+
+    const QString address = DeviceModel::addressOf(info);
+
+    for (int i = 0; i < m_units.size(); i++)
+    {
+        Unit &unit = m_units[i];
+        if (unit.state == Pending && unit.address.compare(address, Qt::CaseInsensitive) == 0)
+        {
+            unit.info = info;
+            unit.state = Discovered;
+            unit.discoveredMs = m_clock.elapsed();
+            qWarning() << "Provisioning:" << unit.label << "found after" << unit.discoveredMs << "ms";
+        }
+    }
+
+    pump();
+}
+
+void BatchProvisioner::scanFinished()
+{
+    for (int i = 0; i < m_units.size(); i++)
+        if (m_units[i].state == Pending)
+        {
+            m_agent->start();
+            return;
+        }
+
+    m_discoveryTimer->stop();
+}
+
+void BatchProvisioner::discoveryTimeout()
+{
+    m_agent->stop();
+
+    for (int i = 0; i < m_units.size(); i++)
+        if (m_units[i].state == Pending)
+            finish(i, "not found");
+}
+
+// Keeps `parallel` units in flight: discovery of the rest continues while
+// these connect and configure.
+void BatchProvisioner::pump()
+{
+    for (int i = 0; i < m_units.size() && m_active < m_parallel; i++)
+        if (m_units[i].state == Discovered)
+            connectUnit(i);
+}
+
+void BatchProvisioner::connectUnit(int n)
+{
+    Unit &unit = m_units[n];
+
+    unit.state = Connecting;
+    unit.connectMs = m_clock.elapsed();
+    m_active++;
+    m_peakActive = qMax(m_peakActive, m_active);
+
+    unit.ble = new BLE(true);
+    connect(unit.ble, &BLE::conEnableChanged, this, [this, n]() {
+        if (m_units[n].ble && m_units[n].ble->con_enable)
+            unitReady(n);
+    });
+
+    unit.timer = new QTimer(unit.ble);
+    unit.timer->setSingleShot(true);
+    connect(unit.timer, &QTimer::timeout, this, [this, n]() {
+        finish(n, QString("timed out while %1").arg(stateName(m_units[n].state)));
+    });
+    unit.timer->start(m_unitTimeoutMs);
+
+    if (isTransport(unit.address))
+        unit.ble->connectToTransport(unit.address);
+    else
+        unit.ble->connectToDevice(unit.info);
+}
+
+void BatchProvisioner::unitReady(int n)
+{
+    Unit &unit = m_units[n];
+    if (unit.state != Connecting)
+        return;
+
+    unit.readyMs = m_clock.elapsed();
+    configure(n);
+}
+
+// Style first: the device loads that style's values, the settings frame
+// queued behind it then overrides them.
+void BatchProvisioner::configure(int n)
+{
+    Unit &unit = m_units[n];
+    unit.state = Configuring;
+    unit.attempts++;
+
+    if (unit.style >= 0 && unit.ble->current_style != unit.style)
+        unit.ble->change_sound_style(unit.style);
+
+    for (int i = 0; i < ParamCount; i++)
+        if (unit.hasTarget[i])
+            unit.ble->changeParam(i, unit.target[i]);
+
+    verify(n);
+}
+
+// Both queries go out at Query priority, after the interactive settings
+// and style frames, so their replies reflect what was just written.
+void BatchProvisioner::verify(int n)
+{
+    Unit &unit = m_units[n];
+    unit.state = Verifying;
+
+    QByteArray version(3, 0);
+    version[0] = char(0xAB);
+    version[1] = char(0xCD);
+    version[2] = 0x0A;
+
+    unit.ble->request(version, OutboundScheduler::Query, VERIFY_TIMEOUT_MS, [this, n](RequestTracker::Status status, const QByteArray &) {
+        if (status == RequestTracker::Replied && m_units[n].ble)
+            m_units[n].firmwareRead = m_units[n].ble->serial_num();
+    });
+
+    QByteArray mode(3, 0);
+    mode[0] = 0x01;
+    mode[1] = 0x02;
+
+    unit.ble->request(mode, OutboundScheduler::Query, VERIFY_TIMEOUT_MS, [this, n](RequestTracker::Status status, const QByteArray &reply) {
+        if (m_units[n].state != Verifying)
+            return;
+        if (status == RequestTracker::Cancelled)
+            finish(n, "link lost during readback");
+        else if (status == RequestTracker::TimedOut)
+            finish(n, "no state readback");
+        else
+            checkReadback(n, reply);
+    });
+}
+
+void BatchProvisioner::checkReadback(int n, const QByteArray &reply)
+{
+    Unit &unit = m_units[n];
+    if (reply.size() < ParamSchema::StateFrameSize)
+    {
+        finish(n, "short state readback");
+        return;
+    }
+
+    ParamSchema::decodeState(reinterpret_cast<const quint8 *>(reply.constData()), unit.readback);
+    unit.readbackStyle = quint8(reply[ParamSchema::StyleOffset]);
+
+    QStringList mismatches;
+    if (unit.style >= 0 && unit.readbackStyle != unit.style)
+        mismatches << QString("style %1 != %2").arg(unit.readbackStyle).arg(unit.style);
+
+    for (int i = 0; i < ParamCount; i++)
+        if (unit.hasTarget[i] && unit.readback[i] != unit.target[i])
+            mismatches << QString("%1 %2 != %3").arg(ParamSchema::params[i].name).arg(unit.readback[i]).arg(unit.target[i]);
+
+    if (!mismatches.isEmpty())
+    {
+        if (unit.attempts < MAX_CONFIGURE_ATTEMPTS)
+        {
+            qWarning() << "Provisioning:" << unit.label << "readback differs, retrying:" << mismatches.join(", ");
+            configure(n);
+        }
+        else
+            finish(n, "readback " + mismatches.join(", "));
+        return;
+    }
+
+    // the version reply was queued first and has arrived by now
+    if (!unit.firmware.isEmpty() && unit.firmwareRead != unit.firmware)
+    {
+        finish(n, QString("firmware %1, expected %2").arg(unit.firmwareRead.isEmpty() ? "unknown" : unit.firmwareRead, unit.firmware));
+        return;
+    }
+
+    finish(n, QString());
+}
+
+void BatchProvisioner::finish(int n, const QString &error)
+{
+    Unit &unit = m_units[n];
+    if (unit.state == Done || unit.state == Failed)
+        return;
+
+    const bool wasActive = unit.ble != 0;
+
+    unit.state = error.isEmpty() ? Done : Failed;
+    unit.error = error;
+    unit.finishedMs = m_clock.elapsed();
+
+    if (unit.ble)
+    {
+        unit.timer->stop();
+        unit.ble->disconnect(this);
+        if (isTransport(unit.address))
+            unit.ble->disconnectTransport();
+        else
+            unit.ble->disconnectService();
+        unit.ble->deleteLater();
+        unit.ble = 0;
+        unit.timer = 0;
+    }
+
+    qWarning() << "Provisioning:" << unit.label << (error.isEmpty() ? QString("done") : "failed: " + error)
+               << "after" << unit.finishedMs << "ms";
+
+    emit unitFinished(n);
+
+    if (wasActive)
+    {
+        m_active--;
+        pump();
+    }
+
+    for (int i = 0; i < m_units.size(); i++)
+        if (m_units[i].state != Done && m_units[i].state != Failed)
+            return;
+
+    m_elapsedMs = m_clock.elapsed();
+    m_discoveryTimer->stop();
+    if (m_agent)
+        m_agent->stop();
+
+    emit finished(failed());
+}
+
+//---------------------------------------------------//
+
+int BatchProvisioner::succeeded() const
+{
+    int count = 0;
+    for (int i = 0; i < m_units.size(); i++)
+        if (m_units[i].state == Done)
+            count++;
+    return count;
+}
+
+int BatchProvisioner::failed() const
+{
+    int count = 0;
+    for (int i = 0; i < m_units.size(); i++)
+        if (m_units[i].state == Failed)
+            count++;
+    return count;
+}
+
+double BatchProvisioner::devicesPerHour() const
+{
+    const qint64 elapsed = m_elapsedMs ? m_elapsedMs : (m_clock.isValid() ? m_clock.elapsed() : 0);
+    if (elapsed <= 0)
+        return 0.0;
+    return succeeded() * 3600000.0 / elapsed;
+}
+
+const char *BatchProvisioner::stateName(UnitState state)
+{
+    static const char *const names[] = {
+        "pending", "discovered", "connecting", "configuring", "verifying", "done", "failed"
+    };
+    return names[state];
+}
+
+QByteArray BatchProvisioner::report() const
+{
+    QJsonArray units;
+
+    for (int n = 0; n < m_units.size(); n++)
+    {
+        const Unit &unit = m_units[n];
+
+        QJsonObject entry;
+        entry.insert("address", unit.address);
+        entry.insert("label", unit.label);
+        entry.insert("state", stateName(unit.state));
+        if (!unit.error.isEmpty())
+            entry.insert("error", unit.error);
+        entry.insert("attempts", unit.attempts);
+        entry.insert("firmware", unit.firmwareRead);
+
+        QJsonObject readback;
+        if (unit.readbackStyle >= 0)
+        {
+            readback.insert("style", unit.readbackStyle);
+            for (int i = 0; i < ParamCount; i++)
+                readback.insert(ParamSchema::params[i].name, unit.readback[i]);
+        }
+        entry.insert("readback", readback);
+
+        QJsonObject timing;
+        timing.insert("discovered_ms", unit.discoveredMs);
+        timing.insert("connect_ms", unit.connectMs);
+        timing.insert("ready_ms", unit.readyMs);
+        timing.insert("finished_ms", unit.finishedMs);
+        if (unit.connectMs >= 0 && unit.finishedMs >= 0)
+            timing.insert("unit_ms", unit.finishedMs - unit.connectMs);
+        entry.insert("timing", timing);
+
+        units.append(entry);
+    }
+
+    QJsonObject root;
+    root.insert("units", units);
+    root.insert("succeeded", succeeded());
+    root.insert("failed", failed());
+    root.insert("elapsed_ms", m_elapsedMs);
+    root.insert("parallel", m_parallel);
+    root.insert("peak_parallel", m_peakActive);
+    root.insert("devices_per_hour", devicesPerHour());
+
+    return QJsonDocument(root).toJson();
+}
+
+QString BatchProvisioner::summary() const
+{
+    QString out;
+
+    for (int n = 0; n < m_units.size(); n++)
+    {
+        const Unit &unit = m_units[n];
+        out += QString("%1  %2  %3  %4 ms  %5\n")
+                .arg(unit.label, -20)
+                .arg(unit.address, -20)
+                .arg(stateName(unit.state), -8)
+                .arg(unit.connectMs >= 0 && unit.finishedMs >= 0 ? unit.finishedMs - unit.connectMs : 0, 6)
+                .arg(unit.error.isEmpty() ? unit.firmwareRead : unit.error);
+    }
+
+    out += QString("%1 of %2 provisioned in %3 s, %4 devices/hour\n")
+            .arg(succeeded()).arg(m_units.size())
+            .arg(m_elapsedMs / 1000.0, 0, 'f', 1)
+            .arg(devicesPerHour(), 0, 'f', 1);
+    return out;
+}
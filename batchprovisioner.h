@@ -0,0 +1,120 @@
+#ifndef BATCHPROVISIONER_H
+#define BATCHPROVISIONER_H
+
+#include <QObject>
+#include <QList>
+#include <QString>
+#include <QElapsedTimer>
+#include <QBluetoothDeviceInfo>
+
+#include "paramschema.h"
+
+class BLE;
+class QTimer;
+class QBluetoothDeviceDiscoveryAgent;
+
+// Commissions a list of amplifiers from a JSON manifest:
+//
+//   { "parallel": 4, "unit_timeout_s": 90, "discovery_timeout_s": 120,
+//     "defaults": { "on_off": 1, "volume": 60 },
+//     "units": [ { "address": "00:15:83:00:12:34", "label": "Hall A",
+//                  "style": 2, "bass": 2400, "firmware": "V1.2" },
+//                { "address": "tcp://192.168.4.1:7000" } ] }
+//
+// One shared scan finds the units; up to `parallel` of them are connected,
+// configured and verified at once, each through its own managed BLE. A unit
+// passes when a fresh mode request reads back the target style and values
+// (one retry) and the version reply matches the expected firmware.
+class BatchProvisioner: public QObject
+{
+    Q_OBJECT
+
+public:
+    enum UnitState {
+        Pending,
+        Discovered,
+        Connecting,
+        Configuring,
+        Verifying,
+        Done,
+        Failed
+    };
+
+    explicit BatchProvisioner(QObject *parent = 0);
+    ~BatchProvisioner();
+
+    bool loadManifest(const QString &path, QString *error = 0);
+    void start();
+
+    int unitCount() const { return m_units.size(); }
+    int succeeded() const;
+    int failed() const;
+
+    // completed units per hour of wall time since start()
+    double devicesPerHour() const;
+
+    QByteArray report() const;      // JSON
+    QString summary() const;        // one line per unit
+
+signals:
+    void unitFinished(int unit);
+    void finished(int failed);
+
+private slots:
+    void deviceDiscovered(const QBluetoothDeviceInfo &info);
+    void scanFinished();
+    void discoveryTimeout();
+
+private:
+    struct Unit
+    {
+        QString address;
+        QString label;
+        int target[ParamCount];
+        bool hasTarget[ParamCount];
+        int style;                  // -1: leave as is
+        QString firmware;           // expected version, empty: any
+
+        UnitState state;
+        QString error;
+        QBluetoothDeviceInfo info;
+        BLE *ble;
+        QTimer *timer;
+        int attempts;
+
+        int readback[ParamCount];
+        int readbackStyle;
+        QString firmwareRead;
+
+        qint64 discoveredMs;        // since start(), -1 if not reached
+        qint64 connectMs;
+        qint64 readyMs;
+        qint64 finishedMs;
+    };
+
+    static bool isTransport(const QString &address);
+    static const char *stateName(UnitState state);
+
+    void pump();
+    void connectUnit(int unit);
+    void unitReady(int unit);
+    void configure(int unit);
+    void verify(int unit);
+    void checkReadback(int unit, const QByteArray &reply);
+    void finish(int unit, const QString &error);
+
+    QList<Unit> m_units;
+    int m_parallel;
+    int m_unitTimeoutMs;
+    int m_discoveryTimeoutMs;
+
+    QBluetoothDeviceDiscoveryAgent *m_agent;
+    QTimer *m_discoveryTimer;
+
+    QElapsedTimer m_clock;
+    qint64 m_elapsedMs;
+    int m_active;
+    int m_peakActive;
+};
+
+#endif // BATCHPROVISIONER_H
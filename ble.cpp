@@ -85,6 +85,9 @@
 
 
 #include "ble.h"
+#include "blemetrics.h"
+#include "alloctracker.h"
+#include "roomanalyzer.h"
 
 #include <QLowEnergyCharacteristic>
 
@@ -92,16 +95,56 @@
 #include <QString>
 #include <QFile>
 #include <QStandardPaths>
+#include <QMetaMethod>
+#include <QLoggingCategory>
+#include <QUrl>
 
 #define CON_PARAMS 1
 
 #define DEVICE_NAME "HM-10"
 
+// devices not heard from for this long drop out of the list
+#define DEVICE_STALE_MS 30000
 
-BLE::BLE():
+// direct reconnects before falling back to scanning by DEVICE_NAME
+#define MAX_RECONNECT_ATTEMPTS 8
+
+// a reconnect that has not brought the link up by then is abandoned
+#define RECONNECT_ATTEMPT_TIMEOUT_MS 10000
+
+// EQ frames written per send opportunity (31 bands fit in two slots at the HM-10 MTU)
+#define EQ_FRAMES_PER_SLOT 4
+
+// optional second characteristic in 0xffe0 that takes bulk traffic
+#define BULK_CHAR_UUID 0xffe2
+
+// reply timeouts of the startup queries and of the whole style table dump
+#define REQUEST_TIMEOUT_MS 1000
+#define CONFIG_DUMP_TIMEOUT_MS 5000
+
+// restore mask bits past the DspParam ones
+#define RESTORE_STYLE (1 << ParamCount)
+#define RESTORE_ALL ((1 << (ParamCount + 1)) - 1)
+
+// per-frame / per-write tracing, off unless QT_LOGGING_RULES="ble.trace.debug=true"
+Q_LOGGING_CATEGORY(bleTrace, "ble.trace", QtInfoMsg)
+
+
+BLE::BLE(bool managed, bool persistent):
     m_currentDevice(QBluetoothDeviceInfo()), foundBLEService(false), m_control(NULL),
-    m_service(NULL)
+    m_service(NULL), m_managed(managed)
 {
+    m_devices = new DeviceModel(this);
+    m_nameVariant = QVariant::fromValue<QObject*>(m_devices);
+    m_transport = NULL;
+
+    m_eq = new EqBandModel(this);
+    connect(m_eq, SIGNAL(dirtied()), this, SLOT(sendNewEq()));
+
+    persistent = persistent && !m_managed;
+
+    m_history = new StateHistory(persistent ? QString() : QString(":memory:"), this);
+
     //! [devicediscovery-1]
     m_deviceDiscoveryAgent = new QBluetoothDeviceDiscoveryAgent(this);
 
@@ -112,29 +155,64 @@ BLE::BLE():
                               this, SLOT(deviceScanError(QBluetoothDeviceDiscoveryAgent::Error)));
 
     connect(m_deviceDiscoveryAgent, SIGNAL(finished()), this, SLOT(scanFinished()));
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+    connect(m_deviceDiscoveryAgent, &QBluetoothDeviceDiscoveryAgent::deviceUpdated,
+            this, [this](const QBluetoothDeviceInfo &info, QBluetoothDeviceInfo::Fields) { updateDevice(info); });
+#endif
     //! [devicediscovery-1]
 
     cur_state = 0;
 
-    if (!cur_state) {
+    if (!cur_state && !m_managed) {
         qDebug() << "Error string: " << m_deviceDiscoveryAgent->errorString();
         m_deviceDiscoveryAgent->start();
     }
 
-    write_timer = new QTimer(this);
+    write_timer = new LinkTimer(this);
     connect(write_timer, SIGNAL(timeout()), this, SLOT(writeDelay()));
 
-    disconnect_timer = new QTimer(this);
-    connect(disconnect_timer, SIGNAL(timeout()), this, SLOT(disconnectDelay()));
+    m_requests = new RequestTracker(this);
+
+    connect(&connetion_check_timer, SIGNAL(timeout()), this, SLOT(linkCheck()));
+
+    reconnect_timer = new LinkTimer(this);
+    reconnect_timer->setSingleShot(true);
+    connect(reconnect_timer, SIGNAL(timeout()), this, SLOT(reconnectDelay()));
+
+    attempt_timer = new LinkTimer(this);
+    attempt_timer->setSingleShot(true);
+    connect(attempt_timer, SIGNAL(timeout()), this, SLOT(attemptTimeout()));
+
+    config_timer = new LinkTimer(this);
+    config_timer->setSingleShot(true);
+    connect(config_timer, SIGNAL(timeout()), this, SLOT(configDumpTimeout()));
+
+    m_userDisconnect = false;
+    m_restorePending = false;
+    m_restoreMask = 0;
+    m_restoreStyle = 0;
+    m_recoveryMs = -1;
 
     con_enable = false;
     Q_EMIT conEnableChanged();
 
-    data_on_off = 1;
-    data_volume = 0;
-    data_bass = 0;
-    data_middle = 0;
-    data_treble = 0;
+    for (int i = 0; i < ParamCount; i++)
+        data_params[i] = 0;
+    data_params[ParamOnOff] = 1;
+    current_style = 0;
+
+    // last confirmed state, so QML starts from real values
+    m_cache = 0;
+    if (persistent)
+    {
+        m_cache = new StateCache(this);
+        m_cache->setSource([this](StateCache::State &state) { fillCachedState(state); });
+        loadCachedState();
+    }
+
+    m_versionRaw = 0;
+    m_settingsFrame = QByteArray(ParamSchema::StateFrameSize, 0);
 
     waiting = 0;
     emit waitingChanged();
@@ -145,37 +223,39 @@ BLE::BLE():
 
 BLE::~BLE()
 {
-    qDeleteAll(m_devices);
-    m_devices.clear();
+    // the cache pulls its state from this object, write it while it is whole
+    if (m_cache)
+        m_cache->flush();
 }
 
 
+// Rows are kept across scans; scanFinished() prunes the stale ones.
 void BLE::deviceSearch()
 {
-    qDeleteAll(m_devices);
-    m_devices.clear();
     m_deviceDiscoveryAgent->start();
-    setMessage("Scanning for devs...");
+    setMessage(QStringLiteral("Scanning for devs..."));
 }
 
 
 void BLE::addDevice(const QBluetoothDeviceInfo &device)
 {
+    ALLOC_PROBE(Scan);
+
     if (device.coreConfigurations() & QBluetoothDeviceInfo::LowEnergyCoreConfiguration)
     {
         #ifdef Q_OS_MAC
             // workaround for Core Bluetooth:
-            qWarning() << "Discovered LE Device name: " << device.name() << " Address: "
-                       << device.deviceUuid().toString();
+            qCDebug(bleTrace) << "Discovered LE Device name: " << device.name() << " Address: "
+                              << device.deviceUuid().toString();
         #else
-            qWarning() << "Discovered LE Device name: " << device.name();
+            qCDebug(bleTrace) << "Discovered LE Device name: " << device.name();
         #endif
 
-        DeviceInfo *dev = new DeviceInfo(device);
-        m_devices.append(dev);
-        setMessage("BLE dev found. Scanning for more...");
+        m_devices->upsert(device);
+        setMessage(QStringLiteral("BLE dev found. Scanning for more..."));
 
-        if (dev->getName().contains(DEVICE_NAME,  Qt::CaseInsensitive) )
+        // a socket backend owns the link while it is selected
+        if (!m_managed && !m_transport && device.name().contains(QLatin1String(DEVICE_NAME), Qt::CaseInsensitive))
         {
             m_deviceDiscoveryAgent->stop();
 
@@ -191,34 +271,64 @@ void BLE::addDevice(const QBluetoothDeviceInfo &device)
     }
 }
 
+void BLE::updateDevice(const QBluetoothDeviceInfo &device)
+{
+    ALLOC_PROBE(Scan);
+
+    // RSSI / name refresh of an already listed device
+    if (m_devices->indexOf(DeviceModel::addressOf(device)) >= 0)
+        m_devices->upsert(device);
+}
+
 void BLE::scanFinished()
 {
-    if (m_devices.size() == 0)
-        setMessage("No Low Energy devices found");
+    BleMetrics::add(BleMetrics::ScanCycles);
 
-    if (!cur_state)
-         m_deviceDiscoveryAgent->start();
+    m_devices->removeStale(DEVICE_STALE_MS);
+    qCDebug(bleTrace) << "devices:" << m_devices->count() << "pool bytes:" << m_devices->memoryFootprint();
+
+    if (m_devices->count() == 0)
+        setMessage(QStringLiteral("No Low Energy devices found"));
 
-    Q_EMIT nameChanged();
+    if (!cur_state && !m_managed)
+         m_deviceDiscoveryAgent->start();
 }
 
 QVariant BLE::name()
 {
-    return QVariant::fromValue(m_devices);
+    return m_nameVariant;
+}
+
+QObject *BLE::devices() const
+{
+    return m_devices;
+}
+
+QObject *BLE::eq() const
+{
+    return m_eq;
+}
+
+QObject *BLE::history() const
+{
+    return m_history;
 }
 
 void BLE::deviceScanError(QBluetoothDeviceDiscoveryAgent::Error error)
 {
     if (error == QBluetoothDeviceDiscoveryAgent::PoweredOffError)
-        setMessage("Turn on bluetooth.");
+        setMessage(QStringLiteral("Turn on bluetooth."));
     else if (error == QBluetoothDeviceDiscoveryAgent::InputOutputError)
-        setMessage("IO from the device error.");
+        setMessage(QStringLiteral("IO from the device error."));
     else
-        setMessage("An unknown error has occurred.");
+        setMessage(QStringLiteral("An unknown error has occurred."));
 }
 
-void BLE::setMessage(QString message)
+void BLE::setMessage(const QString &message)
 {
+    if (m_info == message)
+        return;
+
     m_info = message;
     Q_EMIT messageChanged();
     qDebug() << "message changed: " << message;
@@ -271,20 +381,57 @@ QString BLE::fw_num() const
     return fw_number;
 }
 
+QString BLE::lastDevice() const
+{
+    return m_lastName;
+}
+
+int BLE::signalReceivers(const QByteArray &signature) const
+{
+    return receivers(QByteArray("2" + signature).constData());
+}
+
+
+// Device found by someone else's scan (provisioning)
+void BLE::connectToDevice(const QBluetoothDeviceInfo &info)
+{
+    m_devices->upsert(info);
+    openDevice(DeviceModel::addressOf(info), info);
+}
 
 void BLE::connectToService(const QString &address)
 {
-    for (int i = 0; i < m_devices.size(); i++)
+    openDevice(address, discoveredDevice(address));
+}
+
+// The agent's own record: a pooled row only keeps address, name and RSSI,
+// not the address type, service UUIDs or manufacturer data
+QBluetoothDeviceInfo BLE::discoveredDevice(const QString &address) const
+{
+    const QList<QBluetoothDeviceInfo> found = m_deviceDiscoveryAgent->discoveredDevices();
+    for (int i = 0; i < found.size(); i++)
+        if (DeviceModel::addressOf(found.at(i)) == address)
+            return found.at(i);
+
+    // a restarted scan has not seen it yet: rebuild from the row
+    return m_devices->device(m_devices->indexOf(address));
+}
+
+void BLE::openDevice(const QString &address, const QBluetoothDeviceInfo &info)
+{
+    m_lastAddress = address;
+    m_userDisconnect = false;
+    bringup.start();
+
+    if (info.isValid())
     {
-        qWarning() << "name 1: " <<((DeviceInfo*)m_devices.at(i))->getAddress();
-        qWarning() << "name 2: " <<address;
+        m_currentDevice.setDevice(info);
+        setMessage(QStringLiteral("Connecting to device..."));
 
-        if (((DeviceInfo*)m_devices.at(i))->getAddress() == address )
+        if (m_lastName != m_currentDevice.getName())
         {
-            m_currentDevice.setDevice(((DeviceInfo*)m_devices.at(i))->getDevice());
-            setMessage("Connecting to device...");
-            // deviceFound = true;
-            break;
+            m_lastName = m_currentDevice.getName();
+            Q_EMIT lastDeviceChanged();
         }
     }
 
@@ -294,6 +441,10 @@ void BLE::connectToService(const QString &address)
         m_control = 0;
     }
 
+    delete m_service;
+    m_service = NULL;
+    foundBLEService = false;
+
 
     //! [Connect signals]
     m_control = new QLowEnergyController(m_currentDevice.getDevice(), this);
@@ -307,6 +458,7 @@ void BLE::connectToService(const QString &address)
     connect(m_control, SIGNAL(connectionUpdated(QLowEnergyConnectionParameters)), this, SLOT(connupp(QLowEnergyConnectionParameters)));
     connect(m_control, &QLowEnergyController::connected, [](){qDebug() << "CONNECTED OK";});
 
+    bringup.reach(LinkBringUp::Connecting);
     m_control->connectToDevice();
     //! [Connect signals]
 
@@ -317,6 +469,9 @@ void BLE::connectToService(const QString &address)
 void BLE::connupp(const QLowEnergyConnectionParameters &params)
 {
     qDebug() << "conup(QLowEnergyConnectionParameters)): " << params.maximumInterval();
+
+    pacer.setConnectionInterval(params.maximumInterval());
+    BleMetrics::set(BleMetrics::ConnectionIntervalUs, qRound64(params.maximumInterval() * 1000));
 }
 
 
@@ -324,6 +479,11 @@ void BLE::connupp(const QLowEnergyConnectionParameters &params)
 
 void BLE::deviceConnected()
     {
+    pacer.reset();
+    updateQueueDepth();
+    bringup.reach(LinkBringUp::Discovering);
+
+    // the parameter update runs alongside service discovery
     #ifdef CON_PARAMS
         QLowEnergyConnectionParameters params;
 
@@ -340,9 +500,20 @@ void BLE::deviceConnected()
 
 void BLE::deviceDisconnected()
 {
-    setMessage("Ble service disconnected");
     qWarning() << "Remote device disconnected";
 
+    // BLE was dropped for a socket backend: the link state, heartbeat and
+    // discovery belong to the transport now
+    if (m_transport)
+    {
+        foundBLEService = false;
+        delete m_service;
+        m_service = NULL;
+        return;
+    }
+
+    setMessage(QStringLiteral("Ble service disconnected"));
+
     connetion_check_timer.stop();
 
     cur_state = 0;
@@ -351,35 +522,56 @@ void BLE::deviceDisconnected()
     con_enable = false;
     Q_EMIT conEnableChanged();
 
-    m_deviceDiscoveryAgent->start();
+    // unexpected drop: reconnect directly to the last device
+    if (!m_userDisconnect && !m_lastAddress.isEmpty())
+    {
+        linkLost();
+
+        if (!reconnect_timer->isActive())
+            reconnect_timer->start(watchdog.nextBackoff());
+        return;
+    }
+
+    if (!m_managed)
+        m_deviceDiscoveryAgent->start();
 }
 
+// The HM-10 service is opened as soon as it is found; discovery of the
+// remaining services carries on alongside its detail discovery.
 void BLE::serviceDiscovered(const QBluetoothUuid &gatt)
 {
     if (gatt == QBluetoothUuid((quint16) 0xffe0) )
     {
-        setMessage("Ble service discovered. Waiting for service scan to be done...");
+        setMessage(QStringLiteral("Ble service discovered. Waiting for service scan to be done..."));
         foundBLEService = true;
+
+        if (!m_service)
+            openService();
     }
 }
 
 void BLE::serviceScanDone()
+{
+    if (!m_service && foundBLEService)
+        openService();
+
+    if (!m_service)
+        setMessage(QStringLiteral("Service not found: 11."));
+}
+
+void BLE::openService()
 {
     delete m_service;
     m_service = NULL;
+    m_writeChar = QLowEnergyCharacteristic();
+    m_bulkChar = QLowEnergyCharacteristic();
 
-    if (foundBLEService)
-    {
-        setMessage("Connecting to service...");
-        //        m_service = ->createServiceObject( QBluetoothUuid(QBluetoothUuid::HM_10_CHARACTERISTIC), this);
-        m_service = m_control->createServiceObject( QBluetoothUuid((quint16)0xffe0), this);
-    }
+    setMessage(QStringLiteral("Connecting to service..."));
+    //        m_service = ->createServiceObject( QBluetoothUuid(QBluetoothUuid::HM_10_CHARACTERISTIC), this);
+    m_service = m_control->createServiceObject( QBluetoothUuid((quint16)0xffe0), this);
 
     if (!m_service)
-    {
-        setMessage("Service not found: 11.");
         return;
-    }
 
     connect(m_service, SIGNAL(stateChanged(QLowEnergyService::ServiceState)), this, SLOT(serviceStateChanged(QLowEnergyService::ServiceState)));
 
@@ -387,30 +579,25 @@ void BLE::serviceScanDone()
 
     connect(m_service, SIGNAL(descriptorWritten(QLowEnergyDescriptor,QByteArray)), this, SLOT(confirmedDescriptorWrite(QLowEnergyDescriptor,QByteArray)));
 
-    m_service->discoverDetails();
-
-    setMessage(QString::fromLocal8Bit("Connected"));
-
-
-    #ifdef CON_PARAMS
-        QLowEnergyConnectionParameters params;
-
-        params.setIntervalRange(7.5, 10);
-        params.setSupervisionTimeout(20);
-
-        m_control->requestConnectionUpdate( params );
-
+    connect(m_service, SIGNAL(error(QLowEnergyService::ServiceError)), this, SLOT(serviceError(QLowEnergyService::ServiceError)));
 
-        qWarning() << "conn2, maxInterval: " << params.maximumInterval() << "min interval: "<< params.minimumInterval() << "supervision timeout" << params.supervisionTimeout();
-    #endif
+    bringup.reach(LinkBringUp::ServiceDetails);
+    m_service->discoverDetails();
 }
 
 
 void BLE::disconnectService()
 {
     foundBLEService = false;
-
-    if (m_devices.isEmpty())
+    m_userDisconnect = true;
+    reconnect_timer->stop();
+    attempt_timer->stop();
+    scheduler.clear();
+    updateQueueDepth();
+    bringup.abort();
+    m_requests->cancelAll();
+
+    if (m_devices->count() == 0)
     {
         return;
     }
@@ -430,36 +617,42 @@ void BLE::disconnectService()
     con_enable = false;
     Q_EMIT conEnableChanged();
 
-    setMessage(QString::fromLocal8Bit("Disconnected"));
+    setMessage(QStringLiteral("Disconnected"));
 }
 
 void BLE::controllerError(QLowEnergyController::Error error)
 {
-    setMessage("Cannot connect to remote device.");
+    setMessage(QStringLiteral("Cannot connect to remote device."));
     qWarning() << "Controller Error:" << error;
+
+    if (watchdog.recovering() && !m_userDisconnect && !reconnect_timer->isActive())
+        reconnect_timer->start(watchdog.nextBackoff());
 }
 
 
+// Notifications on 0xffe1 are enabled before the first request goes out,
+// otherwise the state reply can arrive before anyone listens for it.
 void BLE::serviceStateChanged(QLowEnergyService::ServiceState s)
 {
-    setMessage("Connected");
-
     switch (s) {
     case QLowEnergyService::ServiceDiscovered:
     {
-        sendModeReq();
+        // resolved once, every write uses it
+        m_writeChar = m_service->characteristic( QBluetoothUuid((quint16)0xffe1) );
+        m_notificationDesc = m_writeChar.descriptor(QBluetoothUuid::ClientCharacteristicConfiguration);
 
-        const QLowEnergyCharacteristic hrChar = m_service->characteristic( QBluetoothUuid((quint16)0xffe1) );
-        m_notificationDesc = hrChar.descriptor(QBluetoothUuid::ClientCharacteristicConfiguration);
+        m_bulkChar = m_service->characteristic( QBluetoothUuid((quint16)BULK_CHAR_UUID) );
+        if (m_bulkChar.isValid())
+            qWarning() << "Bulk characteristic present, background transfers use it";
 
         if (m_notificationDesc.isValid())
         {
-            // enable notifications
+            // enable notifications, linkReady() follows the confirmation
+            bringup.reach(LinkBringUp::EnablingNotify);
             m_service->writeDescriptor(m_notificationDesc, QByteArray::fromHex("0100"));
-
-            qWarning() << "conn8";
-            connetion_check_timer.start(1000);
         }
+        else
+            linkReady();
 
         break;
     }
@@ -473,7 +666,11 @@ void BLE::serviceError(QLowEnergyService::ServiceError e)
 {
     switch (e) {
     case QLowEnergyService::DescriptorWriteError:
-        setMessage("Cannot obtain BLE notifications");
+        setMessage(QStringLiteral("Cannot obtain BLE notifications"));
+
+        // try anyway, some modules notify without the CCCD write
+        if (bringup.phase() == LinkBringUp::EnablingNotify)
+            linkReady();
         break;
     default:
         qWarning() << "BLE service error:" << e;
@@ -482,8 +679,11 @@ void BLE::serviceError(QLowEnergyService::ServiceError e)
 
 void BLE::updateBLEValue(const QLowEnergyCharacteristic &c, const QByteArray &value)
 {
+    ALLOC_PROBE(Inbound);
+
     // ignore any other characteristic change -> shouldn't really happen though
-    if (c.uuid() != QBluetoothUuid(QBluetoothUuid((quint16)0xffe1)))
+    static const QBluetoothUuid dataUuid((quint16)0xffe1);
+    if (c.uuid() != dataUuid)
         return;
 
     const quint8 *data = reinterpret_cast<const quint8 *>(value.constData());
@@ -502,6 +702,28 @@ void BLE::confirmedDescriptorWrite(const QLowEnergyDescriptor &d,
         delete m_service;
         m_service = 0;
     }
+    else if (d.isValid() && d == m_notificationDesc && value == QByteArray::fromHex("0100"))
+        linkReady();
+}
+
+// Notifications are on: the mode request and the style table CRC go out
+// back to back, the pacer spaces them.
+void BLE::linkReady()
+{
+    if (bringup.phase() == LinkBringUp::AwaitingState)
+        return;
+    bringup.reach(LinkBringUp::AwaitingState);
+
+    attempt_timer->stop();
+    watchdog.linkUp();
+    connetion_check_timer.start(watchdog.interval());
+
+    setMessage(QStringLiteral("Connected"));
+
+    // independent queries, all outstanding at once
+    sendModeReq();
+    GetSerialNumber();
+    requestConfig();
 }
 
 
@@ -513,7 +735,7 @@ QString BLE::deviceAddress() const
 
 int BLE::numDevices() const
 {
-    return m_devices.size();
+    return m_devices->count();
 }
 
 
@@ -522,28 +744,49 @@ int BLE::numDevices() const
 
 void BLE::sendModeReq()
 {
-    if (!foundBLEService)
-    {
-        setMessage(QString::fromLocal8Bit("NO BLE"));
-        return;
-    }
-
-    const QLowEnergyCharacteristic hrChar = m_service->characteristic( QBluetoothUuid((quint16)0xffe1) );
-
-    if (!hrChar.isValid())
-    {
-        setMessage(QString::fromLocal8Bit("BLE Data not found."));
-        return;
-    }
-
     QByteArray arr;
     arr.resize(3);
     arr[0] = 0x01;
     arr[1] = 0x02;
     arr[2] = 0x0;
 
-    m_service->writeCharacteristic(hrChar, arr, QLowEnergyService::WriteWithoutResponse);
-    disconnect_timer->start(500);
+    // the reply is what enables the controls, ask again once if it is lost
+    request(arr, OutboundScheduler::Query, REQUEST_TIMEOUT_MS, [this, arr](RequestTracker::Status status, const QByteArray &) {
+        if (status == RequestTracker::TimedOut && bringup.active())
+        {
+            qWarning() << "Mode request unanswered, retrying";
+            request(arr, OutboundScheduler::Query, REQUEST_TIMEOUT_MS, RequestTracker::Callback());
+        }
+    });
+}
+
+// Reply a request waits for: the pacer's pairs plus the style table CRC.
+// Firmware without the style table never answers that one, so the pacer
+// leaves it out rather than halve its rate on every connect.
+static void requestReply(const QByteArray &frame, quint8 &type, quint8 &cmd)
+{
+    LinkPacer::expectedReply(frame, type, cmd);
+
+    if (!type && frame.size() >= 2 && quint8(frame.at(0)) == 0x05 && quint8(frame.at(1)) == 0x01)
+    {
+        type = 0x05;
+        cmd = 0x81;
+    }
+}
+
+// Queues `frame` and calls back with the matching reply, or ok == false
+// after timeoutMs. The reply type/cmd follow requestReply().
+int BLE::request(const QByteArray &frame, OutboundScheduler::Priority priority, int timeoutMs,
+                 const RequestTracker::Callback &callback, int key)
+{
+    quint8 replyType, replyCmd;
+    requestReply(frame, replyType, replyCmd);
+
+    queueFrame(priority, frame, key);
+
+    if (!replyType)
+        return 0;
+    return m_requests->add(replyType, replyCmd, timeoutMs, callback);
 }
 
 
@@ -551,30 +794,64 @@ void BLE::sendModeReq()
 //---------------------------------------------------//
 
 
-QString BLE::WriteCustomDataToBle(QByteArray arr)
+QString BLE::WriteCustomDataToBle(QByteArray arr, bool bulk)
 {
-    qWarning() << "connn sending user data";
+    qCDebug(bleTrace) << "connn sending user data";
 
-    if (!foundBLEService)
+    if (m_transport)
     {
-        setMessage(QString::fromLocal8Bit("NO BLE"));
-        return QString::fromLocal8Bit("ERROR");
+        // socket backend carries the same frames
+        if (!m_transport->write(arr))
+        {
+            setMessage(QStringLiteral("Transport not connected"));
+            return QStringLiteral("ERROR");
+        }
     }
+    else
+    {
+        if (!foundBLEService)
+        {
+            setMessage(QStringLiteral("NO BLE"));
+            return QStringLiteral("ERROR");
+        }
 
-    //    setMessage(QString::fromLocal8Bit("Out msg: ") + QString::fromLocal8Bit(arr));
+        //    setMessage(QString::fromLocal8Bit("Out msg: ") + QString::fromLocal8Bit(arr));
 
-    const QLowEnergyCharacteristic hrChar = m_service->characteristic( QBluetoothUuid((quint16)0xffe1) );
+        if (!m_writeChar.isValid())
+        {
+            setMessage(QStringLiteral("BLE Data not found."));
+            return QStringLiteral("ERROR");
+        }
 
-    if (!hrChar.isValid())
-    {
-        setMessage(QString::fromLocal8Bit("BLE Data not found."));
-        return QString::fromLocal8Bit("ERROR");
+        //   m_service->writeDescriptor(m_notificationDesc, arr);
+        ALLOC_EXCLUDE();
+        m_service->writeCharacteristic(bulk && m_bulkChar.isValid() ? m_bulkChar : m_writeChar,
+                                       arr, QLowEnergyService::WriteWithoutResponse);
     }
 
-    //   m_service->writeDescriptor(m_notificationDesc, arr);
-    m_service->writeCharacteristic(hrChar, arr, QLowEnergyService::WriteWithoutResponse);
+    quint8 replyType, replyCmd;
+    LinkPacer::expectedReply(arr, replyType, replyCmd);
+    pacer.onSent(arr.size(), replyType, replyCmd);
+
+    BleMetrics::add(BleMetrics::WritesSent);
+    BleMetrics::add(BleMetrics::BytesOut, arr.size());
+    updateQueueDepth();
+
+    return QStringLiteral("OK");
+}
+
+void BLE::queueFrame(OutboundScheduler::Priority priority, const QByteArray &frame, int key)
+{
+    scheduler.enqueue(priority, frame, key);
+    updateQueueDepth();
+
+    if (!write_timer->isActive())
+        write_timer->start(pacer.nextDelay());
+}
 
-    return QString::fromLocal8Bit("OK");
+void BLE::updateQueueDepth()
+{
+    BleMetrics::set(BleMetrics::QueueDepth, pacer.inFlight() + scheduler.size());
 }
 
 
@@ -587,27 +864,27 @@ int BLE::CurState()
 
 int BLE::DataOnOff()
 {
-    return data_on_off;
+    return data_params[ParamOnOff];
 }
 
 int BLE::DataVolume()
 {
-    return data_volume;
+    return data_params[ParamVolume];
 }
 
 int BLE::DataBass()
 {
-    return data_bass;
+    return data_params[ParamBass];
 }
 
 int BLE::DataMiddle()
 {
-    return data_middle;
+    return data_params[ParamMiddle];
 }
 
 int BLE::DataTreble()
 {
-    return data_treble;
+    return data_params[ParamTreble];
 }
 
 int BLE::CurrentStyleOn()
@@ -615,6 +892,17 @@ int BLE::CurrentStyleOn()
     return current_style;
 }
 
+DspParams BLE::dspParams() const
+{
+    DspParams p;
+    p.on_off = data_params[ParamOnOff];
+    p.volume = data_params[ParamVolume];
+    p.bass = data_params[ParamBass];
+    p.middle = data_params[ParamMiddle];
+    p.treble = data_params[ParamTreble];
+    return p;
+}
+
 bool BLE::ConEnable()
 {
     return con_enable;
@@ -627,36 +915,41 @@ int BLE::Waiting()
 
 void BLE::change_data_on_off(int val)
 {
-    qWarning() << "change data on off " << val;
-    data_on_off = val;
-    sendNewSettings();
+    changeParam(ParamOnOff, val);
 }
 
 void BLE::change_data_volume(int val)
 {
-    qWarning() << "change data volume " << val;
-    data_volume = val;
-    sendNewSettings();
+    changeParam(ParamVolume, val);
 }
 
 void BLE::change_data_bass(int val)
 {
-    qWarning() << "change data |bass| " << val;
-    data_bass = val;
-    sendNewSettings();
+    changeParam(ParamBass, val);
 }
 
 void BLE::change_data_middle(int val)
 {
-    qWarning() << "change data |middle| " << val;
-    data_middle = val;
-    sendNewSettings();
+    changeParam(ParamMiddle, val);
 }
 
 void BLE::change_data_treble(int val)
 {
-    qWarning() << "change data |treble| " << val;
-    data_treble = val;
+    changeParam(ParamTreble, val);
+}
+
+// user change: takes over from any ramp on that parameter
+void BLE::changeParam(int param, int val)
+{
+    ALLOC_PROBE(Outbound);
+
+    qCDebug(bleTrace) << "change data" << ParamSchema::params[param].name << val;
+    automation.cancel(param);
+    data_params[param] = val;
+
+    if (!con_enable)
+        holdLocalState(1 << param);
+
     sendNewSettings();
 }
 
@@ -667,6 +960,19 @@ void BLE::change_sound_style(int val)
 
     current_style = val;
     emit sound_style_Changed();
+
+    // known style: show its values now, the 0x03 reply confirms them
+    int values[ParamCount];
+    if (m_config.styleParams(val, values))
+    {
+        for (int i = 0; i < ParamCount; i++)
+            if (data_params[i] != values[i])
+                setParamValue(i, values[i]);
+    }
+
+    if (!con_enable)
+        holdLocalState(RESTORE_STYLE);
+
     sendNewStyle();
 }
 
@@ -678,166 +984,318 @@ void BLE::changeFWNum(QString num)
 }
 
 
+// Values are read when writeDelay() fires, so a timer that is already
+// running will carry the newest value; only arm it when idle.
 QString BLE::sendNewSettings()
 {
-    write_timer->start(20);
-
+    // merged only if an earlier change is still waiting for its frame
+    if (send_flag == 1)
+        BleMetrics::add(BleMetrics::WritesCoalesced);
     send_flag = 1;
-    return QString("OK");
-}
 
-QString BLE::sendNewStyle()
-{
-    write_timer->start(20);
+    if (!write_timer->isActive())
+        write_timer->start(pacer.nextDelay());
 
-    send_flag = 3;
-    return QString("OK");
+    return QStringLiteral("OK");
 }
 
+void BLE::sendNewEq()
+{
+    if (!write_timer->isActive())
+        write_timer->start(pacer.nextDelay());
+}
 
-void BLE::disconnectDelay()
+QString BLE::sendNewStyle()
 {
-    disconnect_timer->stop();
-//    con_enable = false;
+    QByteArray arr;
+    arr.resize(3);
+    arr[0] = 0x03;
+    arr[1] = 2;
+    arr[2] = (char)current_style;
+    queueFrame(OutboundScheduler::Interactive, arr, KeyStyle);
+
+    qWarning() << "set current style: " << current_style;
+
+    return QStringLiteral("OK");
 }
 
 //------------------------------------------------------------//
 
+// Inbound handlers, indexed by DspMessage
+const BLE::FrameHandler BLE::frameHandlers[MsgCount] = {
+    &BLE::onStateFrame,
+    &BLE::onVersionFrame,
+    &BLE::onEqFrame,
+    &BLE::onConfigCrcFrame,
+    &BLE::onConfigRecordFrame
+};
+
 void BLE::ParseIncomeData(const quint8 *data, int size)
 {
+    ALLOC_PROBE(Inbound);
+
+    BleMetrics::add(BleMetrics::BytesIn, size);
+
     if (size < 2)
+    {
+        BleMetrics::add(BleMetrics::ParseFailures);
         return;
+    }
+
+    static const QMetaMethod frameSignal = QMetaMethod::fromSignal(&BLE::frameReceived);
+    if (isSignalConnected(frameSignal))
+        emit frameReceived(QByteArray(reinterpret_cast<const char *>(data), size));
 
     const quint8 type = data[0];
     const quint8 cmd  = data[1];
 
-    const bool isRealTimeData = (cmd == 0x13) && (type == 0x01 || type == 0x02 || type == 0x03);
-    const bool isFwVer  = (type == 0xAB && cmd == 0xDC);
+    pacer.onReceived(type, cmd, size);
+    updateQueueDepth();
 
+    const int rtt = watchdog.rtt();
+    watchdog.onInbound(type == 0xAB && cmd == 0xDC);
+    if (watchdog.rtt() != rtt)
+    {
+        BleMetrics::set(BleMetrics::LinkRttMs, watchdog.rtt());
+        Q_EMIT linkStatsChanged();
+    }
 
-    if ( isFwVer )
+    const int msg = ParamSchema::dispatch(type, cmd, size);
+    if (msg < 0)
     {
-        serial_number.clear();
-        serial_number += "V";
+        if (!m_requests->match(data, size))
+            BleMetrics::add(BleMetrics::ParseFailures);
+        return;
+    }
 
-        quint16 numss =  (quint16)((quint16)data[2] << 8) | (quint16)data[3];
+    (this->*frameHandlers[msg])(data, size);
 
-        serial_number += QString::number((double)numss/10);
+    // callbacks see the state the handler just applied
+    m_requests->match(data, size);
+}
+
+void BLE::onVersionFrame(const quint8 *data, int)
+{
+    quint16 numss =  (quint16)((quint16)data[2] << 8) | (quint16)data[3];
 
+    // every heartbeat reply lands here, compare before building any string
+    if (numss == m_versionRaw)
+        return;
+    m_versionRaw = numss;
+
+    const QString serial = "V" + QString::number((double)numss/10);
+
+    // heartbeat replies repeat the same version, do not re-notify QML
+    if (serial != serial_number)
+    {
+        serial_number = serial;
         Q_EMIT serial_numChanged();
 
         qWarning() << "Serial number read OK: " << serial_number;
+
+        snapshotState();
     }
+}
+
+void BLE::onEqFrame(const quint8 *data, int size)
+{
+    m_eq->applyFrame(data, size);
+}
+
+void BLE::onStateFrame(const quint8 *data, int)
+{
+    qCDebug(bleTrace) << "cur state recieved";
 
+    ParamSchema::decodeState(data, data_params);
 
-    if ( isRealTimeData )   // real time data
+    if (data[0] == 1)
+        current_style = data[ParamSchema::StyleOffset];
+
+    // what the device reports, before any local restore is applied
+    m_history->append(QDateTime::currentMSecsSinceEpoch(), data_params, current_style, data[0]);
+
+    // edits made before the link came up win over the device they were
+    // made for; otherwise the live frame replaces the cached values
+    if (m_restorePending && m_restoreAddress == m_lastAddress)
+        restoreLinkState();
+    else
     {
-        qWarning() << "cur state recieved";
+        m_restorePending = false;
+        if (m_config.markEdited(current_style, data_params))
+            requestConfig();
+        snapshotState();
+    }
 
-        quint8 data_on_off1 = data[2];
-        quint16 data_volume1 = (quint16)((quint16)data[3] << 8) | (quint16)data[4];
-        quint16 data_bass1 = (quint16)((quint16)data[5] << 8) | (quint16)data[6];
-        quint16 data_middle1 = (quint16)((quint16)data[7] << 8) | (quint16)data[8];
-        quint16 data_treble1 = (quint16)((quint16)data[9] << 8) | (quint16)data[10];
-        quint8 current_style1 = data[11];
+    for (int i = 0; i < ParamCount; i++)
+        Q_EMIT (this->*paramNotify[i])();
+    Q_EMIT sound_style_Changed();
 
-        data_on_off = data_on_off1;
-        data_volume = data_volume1;
-        data_bass = data_bass1;
-        data_treble = data_treble1;
-        data_middle = data_middle1;
+    if (con_enable == false)
+    {
+        con_enable = true;
+        Q_EMIT conEnableChanged();
+    }
 
-        if (data[0] == 1)
-            current_style = current_style1;
+    if (bringup.active())
+    {
+        bringup.reach(LinkBringUp::Ready);
+        BleMetrics::set(BleMetrics::FirstControlMs, bringup.timeToFirstControl());
+        Q_EMIT linkStatsChanged();
 
-        Q_EMIT on_off_Changed();
-        Q_EMIT volume_Changed();
-        Q_EMIT bass_Changed();
-        Q_EMIT treble_Changed();
-        Q_EMIT middle_Changed();
-        Q_EMIT sound_style_Changed();
+        qWarning() << "First control after" << bringup.timeToFirstControl() << "ms:" << bringup.breakdown();
+    }
 
-        if (con_enable == false)
-        {
-            con_enable = true;
-            Q_EMIT conEnableChanged();
-        }
+    if (watchdog.recovering())
+    {
+        m_recoveryMs = watchdog.recovered();
+        Q_EMIT linkStatsChanged();
 
-        qWarning() << "";
-        qWarning() << "Current sound style" << current_style;
+        qWarning() << "Link recovered in" << m_recoveryMs << "ms";
+    }
 
-        qWarning() << "data_on_off" << data_on_off;
-        qWarning() << "data_volume" << data_volume;
-        qWarning() << "data_bass" << data_bass;
-        qWarning() << "data_middle" << data_middle;
-        qWarning() << "data_treble" << data_treble;
+    if (bleTrace().isDebugEnabled())
+    {
+        qCDebug(bleTrace) << "Current sound style" << current_style;
+        for (int i = 0; i < ParamCount; i++)
+            qCDebug(bleTrace) << ParamSchema::params[i].name << data_params[i];
     }
 }
 
 
-void BLE::writeDelay()
+// Style table: CRC first, the dump only when the cached copy is stale
+void BLE::requestConfig()
 {
-    if (send_flag == 1)     // presets
+    QByteArray arr;
+    arr.resize(2);
+    arr[0] = 0x05;
+    arr[1] = 0x01;
+    request(arr, OutboundScheduler::Query, REQUEST_TIMEOUT_MS, [](RequestTracker::Status status, const QByteArray &) {
+        if (status == RequestTracker::TimedOut)
+            qWarning() << "No style table support in this firmware";
+    }, KeyConfigCrc);
+}
+
+void BLE::onConfigCrcFrame(const quint8 *data, int)
+{
+    const quint32 crc = qFromBigEndian<quint32>(data + 2);
+    const int styles = data[6];
+
+    if (m_config.valid() && m_config.crc() == crc && m_config.styleCount() == styles)
     {
-        QByteArray arr;
-        arr.resize(12);
-        arr[0] = 0x02;
-        arr[1] = 0x13;
-        arr[2] = 0xFF&data_on_off;
-        arr[3] = 0xFF&(data_volume >> 8);
-        arr[4] = 0xFF&(data_volume);
+        qWarning() << "Style table unchanged, crc" << QString::number(crc, 16);
+        return;
+    }
+
+    m_config.begin(crc, styles);
 
-        arr[5] = 0xFF&(data_bass >> 8);
-        arr[6] = 0xFF&(data_bass);
+    // one reply per style: the whole dump has one deadline, not a request
+    QByteArray arr;
+    arr.resize(2);
+    arr[0] = 0x05;
+    arr[1] = 0x02;
+    queueFrame(OutboundScheduler::Bulk, arr, KeyConfigDump);
+    config_timer->start(CONFIG_DUMP_TIMEOUT_MS);
 
-        arr[7] = 0xFF&(data_middle >> 8);
-        arr[8] = 0xFF&(data_middle);
+    qWarning() << "Fetching style table," << styles << "styles";
+}
 
-        arr[9] = 0xFF&(data_treble >> 8);
-        arr[10] = 0xFF&(data_treble);
+void BLE::configDumpTimeout()
+{
+    if (m_config.complete())
+        return;
 
-        WriteCustomDataToBle(arr);
+    qWarning() << "Style table transfer incomplete, fetched again on next connect";
+    m_config.clear();
+}
 
-        write_timer->start(30);
-        send_flag = 2;
+void BLE::onConfigRecordFrame(const quint8 *data, int size)
+{
+    if (!m_config.applyRecord(data, size))
+        return;
+
+    config_timer->stop();
+
+    if (m_config.valid())
+    {
+        qWarning() << "Style table received";
+        snapshotState();
     }
+    else
+    {
+        qWarning() << "Style table CRC mismatch, dropped";
+        m_config.clear();
+    }
+}
+
+
+// Band changes stay in the dirty bitsets until a slot is near, so the
+// frames carry the newest gains.
+void BLE::flushEq()
+{
+    int frameSize = 20;     // HM-10: default ATT MTU 23
+#if QT_VERSION >= QT_VERSION_CHECK(5, 11, 0)
+    if (m_control && m_control->mtu() > 3)
+        frameSize = m_control->mtu() - 3;
+#endif
+
+    while (m_eq->dirty() && scheduler.depth(OutboundScheduler::Interactive) < EQ_FRAMES_PER_SLOT)
+        scheduler.enqueue(OutboundScheduler::Interactive, m_eq->takeDirtyFrame(frameSize));
+}
+
+// One send opportunity: the settings frame is encoded here from the current
+// values, then the scheduler picks what goes out. Consecutive EQ frames
+// share the slot.
+void BLE::writeDelay()
+{
+    ALLOC_PROBE(Outbound);
 
-    if (send_flag == 3)     // Getting current style
+    if (send_flag == 1)     // presets
     {
-        QByteArray arr;
-        arr.resize(3);
-        arr[0] = 0x03;
-        arr[1] = 2;
-        arr[2] = (char)current_style;
-        WriteCustomDataToBle(arr);
+        if (automation.active())
+            applyAutomation();
+
+        // encoded in place, the scheduler copies the bytes into its slot
+        quint8 *frame = reinterpret_cast<quint8 *>(m_settingsFrame.data());
+        frame[0] = 0x02;
+        frame[1] = 0x13;
+        ParamSchema::encodeState(data_params, frame);
+        frame[ParamSchema::StyleOffset] = quint8(current_style);
 
-        qWarning() << "set current style: " << current_style;
+        scheduler.enqueue(OutboundScheduler::Interactive, m_settingsFrame, KeySettings);
 
-        write_timer->start(30);
-        send_flag = 2;
+        // running ramps get the next send opportunity as well
+        if (!automation.active())
+            send_flag = 0;
     }
 
+    if (m_eq->dirty())
+        flushEq();
 
-    if (send_flag == 10)     // Getting serial number
+    for (int i = 0; i < EQ_FRAMES_PER_SLOT; i++)
     {
-        QByteArray arr;
-        arr.resize(3);
-        arr[0] = 0xAB;
-        arr[1] = 0xCD;
-        arr[2] = 0x0A;
-        WriteCustomDataToBle(arr);
+        OutboundScheduler::Priority priority;
+        const QByteArray arr = scheduler.take(&priority);
+        if (arr.isEmpty())
+            break;
 
-        qWarning() << "Getting serial number sended";
+        WriteCustomDataToBle(arr, priority == OutboundScheduler::Bulk);
 
-        write_timer->start(50);
-        send_flag = 2;
+        if (arr.at(0) != 0x04 || !scheduler.peek().startsWith(char(0x04)))
+            break;
     }
 
-    if (send_flag == 2)
+    if (send_flag || m_eq->dirty() || !scheduler.isEmpty())
     {
-        write_timer->stop();
-        send_flag = 0;
+        // re-armed only when the pace changes
+        const int delay = qMax(pacer.nextDelay(), 1);
+        if (write_timer->interval() != delay)
+            write_timer->start(delay);
     }
+    else
+        write_timer->stop();
+
+    // after the takes; nextDelay() has dropped replies given up on
+    updateQueueDepth();
 }
 
 
@@ -859,9 +1317,452 @@ void BLE::change_aux(int val)
     }
 }
 
+//------------------------------------------------------------//
+
+// Use a TCP / local socket peer instead of the GATT link; same frames.
+void BLE::connectToTransport(const QString &url)
+{
+    // leave BLE alone while a socket backend is selected
+    cur_state = 1;
+    m_deviceDiscoveryAgent->stop();
+    reconnect_timer->stop();
+    attempt_timer->stop();
+
+    if (m_control)
+    {
+        m_userDisconnect = true;
+        m_control->disconnectFromDevice();
+    }
+
+    if (!m_transport)
+    {
+        m_transport = new StreamTransport(this);
+
+        connect(m_transport, SIGNAL(connected()), this, SLOT(transportConnected()));
+        connect(m_transport, SIGNAL(disconnected()), this, SLOT(transportDisconnected()));
+        connect(m_transport, SIGNAL(errorOccurred(QString)), this, SLOT(transportError(QString)));
+        connect(m_transport, SIGNAL(frameReceived(QByteArray)), this, SLOT(transportFrame(QByteArray)), Qt::DirectConnection);
+    }
+
+    setMessage("Connecting to " + url);
+    bringup.start();
+    bringup.reach(LinkBringUp::Connecting);
+    m_transport->open(url);
+}
+
+void BLE::disconnectTransport()
+{
+    if (!m_transport)
+        return;
+
+    m_transport->close();
+    m_transport->deleteLater();
+    m_transport = NULL;
+
+    attempt_timer->stop();
+    connetion_check_timer.stop();
+    con_enable = false;
+    Q_EMIT conEnableChanged();
+
+    // back to scanning for the BLE module
+    cur_state = 0;
+    if (!m_managed)
+        m_deviceDiscoveryAgent->start();
+}
+
+void BLE::transportConnected()
+{
+    pacer.reset();
+    updateQueueDepth();
+    linkReady();
+}
+
+void BLE::transportDisconnected()
+{
+    connetion_check_timer.stop();
+
+    if (con_enable)
+    {
+        linkLost();
+
+        con_enable = false;
+        Q_EMIT conEnableChanged();
+    }
+
+    if (watchdog.recovering() && !reconnect_timer->isActive())
+        reconnect_timer->start(watchdog.nextBackoff());
+    else
+        setMessage(QStringLiteral("Transport disconnected"));
+}
+
+// A link that was up reports disconnected() as well and is handled there;
+// a connect that never got through, the first one included, is retried.
+void BLE::transportError(const QString &error)
+{
+    setMessage("Transport error: " + error);
+
+    if (con_enable)
+        return;
+
+    if (!watchdog.recovering())
+        watchdog.linkLost();
+
+    if (!reconnect_timer->isActive())
+        reconnect_timer->start(watchdog.nextBackoff());
+}
+
+void BLE::transportFrame(const QByteArray &frame)
+{
+    ParseIncomeData(reinterpret_cast<const quint8 *>(frame.constData()), frame.size());
+}
+
+int BLE::LinkRtt()
+{
+    return watchdog.rtt();
+}
+
+int BLE::FirstControlMs()
+{
+    return int(bringup.timeToFirstControl());
+}
+
+int BLE::RecoveryMs()
+{
+    return m_recoveryMs;
+}
+
+void BLE::setHeartbeat(int intervalMs, int maxMisses)
+{
+    watchdog.setInterval(intervalMs);
+    watchdog.setMaxMisses(maxMisses);
+
+    if (connetion_check_timer.isActive())
+        connetion_check_timer.start(watchdog.interval());
+}
+
+void BLE::seedBackoff(quint32 seed)
+{
+    watchdog.setSeed(seed);
+}
+
+void BLE::linkCheck()
+{
+    switch (watchdog.tick()) {
+    case LinkWatchdog::SendPing:
+    {
+        ALLOC_PROBE(Outbound);
+
+        // firmware version request doubles as ping, answered with 0xAB 0xDC;
+        // written directly, a queued ping would measure the queue
+        static const QByteArray ping("\xAB\xCD\x0A", 3);
+        WriteCustomDataToBle(ping);
+
+        watchdog.onPingSent();
+        break;
+    }
+    case LinkWatchdog::Dead:
+    {
+        qWarning() << "Link dead," << watchdog.misses() << "heartbeats missed";
+
+        connetion_check_timer.stop();
+        linkLost();
+
+        reconnect_timer->start(watchdog.nextBackoff());
+
+        if (m_transport)
+            m_transport->close();
+        else if (m_control)
+            m_control->disconnectFromDevice();
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Remember what the user had set so it can be pushed back after reconnect
+void BLE::linkLost()
+{
+    if (watchdog.recovering())
+        return;
+
+    watchdog.linkLost();
+    setMessage(QStringLiteral("Link lost, reconnecting..."));
+
+    // queued frames were meant for the old link, the restore re-sends state
+    scheduler.clear();
+    updateQueueDepth();
+    bringup.abort();
+    m_requests->cancelAll();
+
+    if (con_enable)
+    {
+        for (int i = 0; i < ParamCount; i++)
+            m_restoreParams[i] = data_params[i];
+        m_restoreStyle = current_style;
+        m_restoreMask = RESTORE_ALL;
+        m_restoreAddress = m_lastAddress;
+        m_restorePending = true;
+    }
+}
+
+void BLE::reconnectDelay()
+{
+    if (m_transport)
+    {
+        BleMetrics::add(BleMetrics::Reconnects);
+        bringup.start();
+        bringup.reach(LinkBringUp::Connecting);
+        attempt_timer->start(RECONNECT_ATTEMPT_TIMEOUT_MS);
+        m_transport->open(m_transport->url());
+        return;
+    }
+
+    if (m_userDisconnect)
+        return;
+
+    if (watchdog.attempts() > MAX_RECONNECT_ATTEMPTS && !m_managed)
+    {
+        qWarning() << "Reconnect attempts exhausted, scanning for" << DEVICE_NAME;
+        m_deviceDiscoveryAgent->start();
+        return;
+    }
+
+    qWarning() << "Reconnect attempt" << watchdog.attempts() << "to" << m_lastAddress;
+    BleMetrics::add(BleMetrics::Reconnects);
+    attempt_timer->start(RECONNECT_ATTEMPT_TIMEOUT_MS);
+    connectToService(m_lastAddress);
+}
+
+// The attempt neither failed nor got through: drop it and back off again
+void BLE::attemptTimeout()
+{
+    // it did fail meanwhile, the next attempt is already scheduled
+    if (reconnect_timer->isActive())
+        return;
+
+    qWarning() << "Reconnect attempt" << watchdog.attempts() << "timed out";
+
+    if (m_transport)
+        m_transport->close();
+    else if (m_control)
+    {
+        // no late signals from it, the next attempt creates a new controller
+        m_control->disconnect(this);
+        m_control->disconnectFromDevice();
+    }
+
+    reconnect_timer->start(watchdog.nextBackoff());
+}
+
+void BLE::restoreLinkState()
+{
+    m_restorePending = false;
+
+    if ((m_restoreMask & RESTORE_STYLE) && current_style != m_restoreStyle)
+    {
+        current_style = m_restoreStyle;
+        sendNewStyle();
+    }
+
+    // untouched parameters keep what the device just reported
+    for (int i = 0; i < ParamCount; i++)
+        if (m_restoreMask & (1 << i))
+            data_params[i] = m_restoreParams[i];
+    m_restoreMask = 0;
+
+    sendNewSettings();
+
+    qWarning() << "Restored last known state after reconnect";
+}
+
+void BLE::loadCachedState()
+{
+    StateCache::State state;
+    for (int i = 0; i < ParamCount; i++)
+        state.params[i] = data_params[i];
+    state.style = current_style;
+    state.configCrc = 0;
+
+    if (!m_cache->load(state))
+        return;
+
+    if (!state.config.isEmpty())
+        m_config.restore(state.configCrc, state.config);
+
+    for (int i = 0; i < ParamCount; i++)
+        data_params[i] = state.params[i];
+    current_style = state.style;
+
+    serial_number = state.serial;
+    fw_number = state.firmware;
+    m_lastAddress = state.address;
+    m_lastName = state.name;
+
+    qWarning() << "Loaded last known state of" << m_lastName << m_lastAddress;
+}
+
+void BLE::snapshotState()
+{
+    if (m_cache)
+        m_cache->touch();
+}
+
+void BLE::fillCachedState(StateCache::State &state)
+{
+    for (int i = 0; i < ParamCount; i++)
+        state.params[i] = data_params[i];
+    state.style = current_style;
+    state.serial = serial_number;
+    state.firmware = fw_number;
+    state.address = m_lastAddress;
+    state.name = m_lastName;
+    state.configCrc = m_config.valid() ? m_config.crc() : 0;
+    if (m_config.valid())
+        state.config = m_config.records();
+}
+
+// Changes made while no device answers are pushed on the next state frame
+// instead of being overwritten by it, same as after a reconnect; only the
+// values in mask, and only to the device they were made for.
+void BLE::holdLocalState(int mask)
+{
+    if (!m_restorePending)
+        m_restoreMask = 0;
+
+    for (int i = 0; i < ParamCount; i++)
+        m_restoreParams[i] = data_params[i];
+    m_restoreStyle = current_style;
+    m_restoreMask |= mask;
+    m_restoreAddress = m_lastAddress;
+    m_restorePending = true;
+}
+
+//------------------------------------------------------------//
+
+// NOTIFY signal of each Q_PROPERTY, indexed by DspParam
+void (BLE::*const BLE::paramNotify[ParamCount])() = {
+    &BLE::on_off_Changed,
+    &BLE::volume_Changed,
+    &BLE::bass_Changed,
+    &BLE::middle_Changed,
+    &BLE::treble_Changed
+};
+
+int BLE::paramValue(int param) const
+{
+    return data_params[param];
+}
+
+void BLE::setParamValue(int param, int value)
+{
+    data_params[param] = value;
+    Q_EMIT (this->*paramNotify[param])();
+}
+
+void BLE::rampParameter(const QString &param, int target, int durationMs, int curve)
+{
+    const int id = ParamSchema::paramByName(param);
+    if (id < 0)
+    {
+        qWarning() << "rampParameter: unknown parameter" << param;
+        return;
+    }
+
+    // starting from the value last sent merges with a ramp already running
+    automation.start(id, paramValue(id), target, durationMs,
+                     ParamAutomation::Curve(qBound(0, curve, int(ParamAutomation::SCurve))));
+
+    sendNewSettings();
+}
+
+void BLE::cancelRamp(const QString &param)
+{
+    automation.cancel(ParamSchema::paramByName(param));
+}
+
+void BLE::cancelAllRamps()
+{
+    automation.cancelAll();
+}
+
+QVariantMap BLE::suggestRoomCorrection(const QString &wavPath, const QString &targetPath)
+{
+    QVariantMap result;
+    result["ok"] = false;
+
+    // FileDialog hands out file: URLs
+    const QString wav = wavPath.startsWith("file:") ? QUrl(wavPath).toLocalFile() : wavPath;
+    const QString target = targetPath.startsWith("file:") ? QUrl(targetPath).toLocalFile() : targetPath;
+
+    RoomAnalyzer analyzer;
+    QString error;
+    if ((!target.isEmpty() && !analyzer.loadTarget(target, &error)) || !analyzer.analyseWav(wav, &error))
+    {
+        qWarning() << "Room correction:" << error;
+        result["error"] = error;
+        return result;
+    }
+
+    const RoomCorrection correction = analyzer.suggest(dspParams());
+
+    result["ok"] = correction.valid;
+    result["bass"] = correction.params.bass;
+    result["middle"] = correction.params.middle;
+    result["treble"] = correction.params.treble;
+    result["before_db"] = correction.rmsBeforeDb;
+    result["after_db"] = correction.rmsAfterDb;
+    result["analysis_ms"] = correction.analysisMs;
+    return result;
+}
+
+void BLE::applyToneStack(int bass, int middle, int treble)
+{
+    const int params[3] = { ParamBass, ParamMiddle, ParamTreble };
+    const int values[3] = { bass, middle, treble };
+
+    for (int i = 0; i < 3; i++)
+    {
+        automation.cancel(params[i]);
+        if (data_params[params[i]] != values[i])
+            setParamValue(params[i], values[i]);
+    }
+
+    if (!con_enable)
+        holdLocalState((1 << ParamBass) | (1 << ParamMiddle) | (1 << ParamTreble));
+
+    // one send_flag, one 0x02 0x13 frame for all three
+    sendNewSettings();
+}
+
+void BLE::applyAutomation()
+{
+    for (int param = 0; param < ParamCount; param++)
+    {
+        if (!automation.active(param))
+            continue;
+
+        const int value = automation.valueAt(param);
+        if (value != paramValue(param))
+            setParamValue(param, value);
+    }
+}
+
 int BLE::GetSerialNumber()
 {
-    send_flag = 10;
-    write_timer->start(10);
+    // Start.qml asks as well once "Connected" shows; one request is enough
+    if (m_requests->pending(0xAB, 0xDC))
+        return 0;
+
+    QByteArray arr;
+    arr.resize(3);
+    arr[0] = 0xAB;
+    arr[1] = 0xCD;
+    arr[2] = 0x0A;
+    request(arr, OutboundScheduler::Query, REQUEST_TIMEOUT_MS, [](RequestTracker::Status status, const QByteArray &) {
+        if (status == RequestTracker::TimedOut)
+            qWarning() << "Serial number request timed out";
+    }, KeyVersion);
+
     return 0;
 }
@@ -43,11 +43,27 @@
 #define BLE_H
 
 #include "deviceinfo.h"
+#include "devicemodel.h"
+#include "configsnapshot.h"
+#include "eqbandmodel.h"
+#include "streamtransport.h"
+#include "dspengine.h"
+#include "linkpacer.h"
+#include "outboundscheduler.h"
+#include "requesttracker.h"
+#include "linkwatchdog.h"
+#include "linkbringup.h"
+#include "paramautomation.h"
+#include "paramschema.h"
+#include "statecache.h"
+#include "statehistory.h"
+#include "linkclock.h"
 
 #include <QString>
 #include <QDebug>
 #include <QDateTime>
 #include <QVector>
+#include <QVariantMap>
 #include <QTimer>
 #include <QBluetoothDeviceDiscoveryAgent>
 #include <QBluetoothDeviceInfo>
@@ -66,7 +82,11 @@ class BLE: public QObject
     Q_PROPERTY(QString busy_message READ busy_message NOTIFY busy_messageChanged)
     Q_PROPERTY(QString serial_num READ serial_num NOTIFY serial_numChanged)
     Q_PROPERTY(QVariant name READ name NOTIFY nameChanged)
+    Q_PROPERTY(QObject* devices READ devices CONSTANT)
+    Q_PROPERTY(QObject* eq READ eq CONSTANT)
+    Q_PROPERTY(QObject* history READ history CONSTANT)
     Q_PROPERTY(QString fw_num READ fw_num NOTIFY fw_numChanged)
+    Q_PROPERTY(QString last_device READ lastDevice NOTIFY lastDeviceChanged)
 
     Q_PROPERTY(int data_on_off READ DataOnOff WRITE change_data_on_off NOTIFY on_off_Changed)
     Q_PROPERTY(int data_volume READ DataVolume WRITE change_data_volume NOTIFY volume_Changed)
@@ -78,6 +98,10 @@ class BLE: public QObject
     Q_PROPERTY(bool con_enable READ ConEnable NOTIFY conEnableChanged)
     Q_PROPERTY(int waiting READ Waiting NOTIFY waitingChanged)
 
+    Q_PROPERTY(int link_rtt READ LinkRtt NOTIFY linkStatsChanged)
+    Q_PROPERTY(int recovery_ms READ RecoveryMs NOTIFY linkStatsChanged)
+    Q_PROPERTY(int first_control_ms READ FirstControlMs NOTIFY linkStatsChanged)
+
 
 Q_SIGNALS:
     void carsChanged();
@@ -102,12 +126,22 @@ public:
 
     int Waiting();
 
+    int LinkRtt();
+    int RecoveryMs();
+    int FirstControlMs();
+
 
 public:
-    BLE();
+    // managed: driven by a controller (batch provisioning), no scanning or
+    // auto-connect by DEVICE_NAME, no shared last-state cache or history file;
+    // !persistent: neither file either, another process on the same data
+    // directory owns them (broker clients)
+    explicit BLE(bool managed = false, bool persistent = true);
     ~BLE();
 
-    void setMessage(QString message);
+    void connectToDevice(const QBluetoothDeviceInfo &info);
+
+    void setMessage(const QString &message);
     QString message() const;
 
     void setBusyMessage(QString message);
@@ -122,16 +156,22 @@ public:
     QString fw_num() const;
     QString fw_number = "";
 
+    QString lastDevice() const;
+
+    // connections to a signal, QML bindings included (render profiling)
+    int signalReceivers(const QByteArray &signature) const;
+
     QVariant name();
+    QObject *devices() const;
+    QObject *eq() const;
+    QObject *history() const;
 
-    int data_on_off;
-    int data_volume;
-    int data_bass;
-    int data_middle;
-    int data_treble;
+    int data_params[ParamCount];
 
     int current_style;
 
+    DspParams dspParams() const;
+
     bool con_enable;
 
     int send_flag;
@@ -152,6 +192,7 @@ public slots:
 
     QString sendNewSettings();
     QString sendNewStyle();
+    void sendNewEq();
 
     void change_data_on_off(int val);
     void change_data_volume(int val);
@@ -162,6 +203,24 @@ public slots:
     void changeFWNum(QString num);
     void change_aux(int val);
 
+    void setHeartbeat(int intervalMs, int maxMisses);
+
+    // tcp://host:port, unix:/path or local:name
+    void connectToTransport(const QString &url);
+    void disconnectTransport();
+
+    // curve: 0 linear, 1 exponential, 2 S-curve
+    void rampParameter(const QString &param, int target, int durationMs, int curve);
+    void cancelRamp(const QString &param);
+    void cancelAllRamps();
+
+    // room measurement WAV (sweep or pink noise) -> suggested tone stack, see
+    // RoomAnalyzer; keys ok, error, bass, middle, treble, before_db, after_db,
+    // analysis_ms. Nothing is sent.
+    QVariantMap suggestRoomCorrection(const QString &wavPath, const QString &targetPath = QString());
+    // all three in one settings frame
+    void applyToneStack(int bass, int middle, int treble);
+
 signals:
     void on_off_Changed();
     void volume_Changed();
@@ -171,6 +230,7 @@ signals:
     void sound_style_Changed();
     void conEnableChanged();
     void waitingChanged();
+    void linkStatsChanged();
 
 public:
     void sendModeReq();
@@ -180,13 +240,27 @@ public:
 
 
 public:
-    QString WriteCustomDataToBle(QByteArray arr);
+    QString WriteCustomDataToBle(QByteArray arr, bool bulk = false);
+
+    // frames for writeDelay(); key != 0 replaces a queued frame with that key
+    void queueFrame(OutboundScheduler::Priority priority, const QByteArray &frame, int key = 0);
+
+    int request(const QByteArray &frame, OutboundScheduler::Priority priority, int timeoutMs,
+                const RequestTracker::Callback &callback, int key = 0);
+
+    void changeParam(int param, int val);
+
+    // frames queued plus requests awaiting a reply
+    void updateQueueDepth();
+
+    void seedBackoff(quint32 seed);
 
     void ParseIncomeData(const quint8 *data, int size);
 
 private slots:
     //  QBluetothDeviceDiscoveryAgent
     void addDevice(const QBluetoothDeviceInfo&);
+    void updateDevice(const QBluetoothDeviceInfo&);
     void scanFinished();
     void deviceScanError(QBluetoothDeviceDiscoveryAgent::Error);
 
@@ -214,31 +288,119 @@ Q_SIGNALS:
     void busy_messageChanged();
     void serial_numChanged();
     void fw_numChanged();
+    void lastDeviceChanged();
 
     void stateChanged();
     void new_data();
 
+    // every inbound frame, emitted only while something is connected (broker)
+    void frameReceived(const QByteArray &frame);
+
 private:
-    QTimer *write_timer;
-    QTimer *disconnect_timer;
+    void openDevice(const QString &address, const QBluetoothDeviceInfo &info);
+    QBluetoothDeviceInfo discoveredDevice(const QString &address) const;
+
+    LinkTimer *write_timer;
+    QByteArray m_settingsFrame;
+    quint16 m_versionRaw;
+
+    LinkPacer pacer;
+    OutboundScheduler scheduler;
+
+    enum OutboundKey {
+        KeyNone,
+        KeySettings,
+        KeyStyle,
+        KeyVersion,
+        KeyConfigCrc,
+        KeyConfigDump
+    };
 
 private slots:
     void writeDelay();
-    void disconnectDelay();
+    void linkCheck();
+    void reconnectDelay();
+    void attemptTimeout();
+    void configDumpTimeout();
+
+    void transportConnected();
+    void transportDisconnected();
+    void transportError(const QString &error);
+    void transportFrame(const QByteArray &frame);
+
+private:
+    void linkLost();
+    void linkReady();
+    void restoreLinkState();
+    void openService();
+
+    LinkBringUp bringup;
+    RequestTracker *m_requests;
+
+    int paramValue(int param) const;
+    void setParamValue(int param, int value);
+    void applyAutomation();
+
+    ParamAutomation automation;
+
+    typedef void (BLE::*FrameHandler)(const quint8 *data, int size);
+    static const FrameHandler frameHandlers[MsgCount];
+    static void (BLE::*const paramNotify[ParamCount])();
+
+    void onStateFrame(const quint8 *data, int size);
+    void onVersionFrame(const quint8 *data, int size);
+    void onEqFrame(const quint8 *data, int size);
+    void onConfigCrcFrame(const quint8 *data, int size);
+    void onConfigRecordFrame(const quint8 *data, int size);
+
+    void requestConfig();
+    ConfigSnapshot m_config;
+    LinkTimer *config_timer;
+
+    void flushEq();
+
+    void loadCachedState();
+    void snapshotState();
+    void fillCachedState(StateCache::State &state);
+    void holdLocalState(int mask);
+
+    StateCache *m_cache;
+    QString m_lastName;
+
+    EqBandModel *m_eq;
+    StateHistory *m_history;
+    StreamTransport *m_transport;
 
 private:
     DeviceInfo m_currentDevice;
     QBluetoothDeviceDiscoveryAgent *m_deviceDiscoveryAgent;
     QLowEnergyDescriptor m_notificationDesc;
-    QList<QObject*> m_devices;
+    DeviceModel *m_devices;
+    QVariant m_nameVariant;
     QString m_info;
     bool foundBLEService;
 
     QLowEnergyController *m_control;
     QLowEnergyService *m_service;
+    QLowEnergyCharacteristic m_writeChar;
+    QLowEnergyCharacteristic m_bulkChar;
 
 private:
-    QTimer connetion_check_timer;
+    LinkTimer connetion_check_timer;
+    LinkTimer *reconnect_timer;
+    LinkTimer *attempt_timer;
+
+    LinkWatchdog watchdog;
+    QString m_lastAddress;
+    bool m_userDisconnect;
+    bool m_managed;
+
+    bool m_restorePending;
+    int m_restoreMask;              // bit per DspParam, RESTORE_STYLE
+    int m_restoreParams[ParamCount];
+    int m_restoreStyle;
+    QString m_restoreAddress;       // device the held values are for
+    int m_recoveryMs;
 
 };
 
@@ -0,0 +1,241 @@
+#include "blemetrics.h"
+
+#include <QDebug>
+#include <QThread>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QHostAddress>
+#include <QVariant>
+#include <QTimer>
+
+// a scraper sends its request right after connecting
+#define REQUEST_TIMEOUT_MS  5000
+
+BleMetrics::Slot BleMetrics::s_slots[BleMetrics::MaxSlots];
+std::atomic<int> BleMetrics::s_nextSlot(0);
+std::atomic<qint64> BleMetrics::s_gauges[BleMetrics::GaugeCount];
+
+static const struct {
+    const char *name;
+    const char *help;
+} counterInfo[BleMetrics::CounterCount] = {
+    { "ble_writes_sent_total",      "Frames written to the device." },
+    { "ble_writes_coalesced_total", "Parameter changes merged into an already pending write." },
+    { "ble_bytes_out_total",        "Bytes written to the device." },
+    { "ble_bytes_in_total",         "Bytes received in notifications." },
+    { "ble_parse_failures_total",   "Inbound frames that could not be parsed." },
+    { "ble_reconnects_total",       "Reconnect attempts after a lost link." },
+    { "ble_scan_cycles_total",      "Finished device discovery cycles." }
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+} gaugeInfo[BleMetrics::GaugeCount] = {
+    { "ble_connection_interval_microseconds", "Current BLE connection interval." },
+    { "ble_queue_depth",                      "Outbound frames waiting or unanswered." },
+    { "ble_link_rtt_milliseconds",            "Last heartbeat round trip time." },
+    { "ble_first_control_milliseconds",       "Connect to first state frame of the last bring-up." }
+};
+
+
+BleMetrics::Slot &BleMetrics::slot()
+{
+    // threads beyond MaxSlots share slots, adds stay atomic
+    static thread_local int index = s_nextSlot.fetch_add(1, std::memory_order_relaxed) % MaxSlots;
+    return s_slots[index];
+}
+
+void BleMetrics::add(Counter c, quint64 value)
+{
+    slot().counters[c].fetch_add(value, std::memory_order_relaxed);
+}
+
+void BleMetrics::set(Gauge g, qint64 value)
+{
+    s_gauges[g].store(value, std::memory_order_relaxed);
+}
+
+quint64 BleMetrics::counter(Counter c)
+{
+    quint64 sum = 0;
+    for (int i = 0; i < MaxSlots; i++)
+        sum += s_slots[i].counters[c].load(std::memory_order_relaxed);
+    return sum;
+}
+
+qint64 BleMetrics::gauge(Gauge g)
+{
+    return s_gauges[g].load(std::memory_order_relaxed);
+}
+
+QByteArray BleMetrics::exposition()
+{
+    QByteArray out;
+    out.reserve(1024);
+
+    for (int c = 0; c < CounterCount; c++)
+    {
+        out += "# HELP "; out += counterInfo[c].name; out += ' '; out += counterInfo[c].help; out += '\n';
+        out += "# TYPE "; out += counterInfo[c].name; out += " counter\n";
+        out += counterInfo[c].name; out += ' '; out += QByteArray::number(counter(Counter(c))); out += '\n';
+    }
+
+    for (int g = 0; g < GaugeCount; g++)
+    {
+        out += "# HELP "; out += gaugeInfo[g].name; out += ' '; out += gaugeInfo[g].help; out += '\n';
+        out += "# TYPE "; out += gaugeInfo[g].name; out += " gauge\n";
+        out += gaugeInfo[g].name; out += ' '; out += QByteArray::number(gauge(Gauge(g))); out += '\n';
+    }
+
+    return out;
+}
+
+
+//---------------------------------------------------//
+
+MetricsServer::MetricsServer(const QString &address):
+    QObject(), m_address(address), m_thread(0), m_tcp(0), m_local(0)
+{
+}
+
+MetricsServer *MetricsServer::start(const QString &address)
+{
+    MetricsServer *server = new MetricsServer(address);
+
+    server->m_thread = new QThread;
+    server->m_thread->setObjectName("BleMetrics");
+    server->moveToThread(server->m_thread);
+
+    connect(server->m_thread, SIGNAL(started()), server, SLOT(listen()));
+    server->m_thread->start(QThread::LowPriority);
+
+    return server;
+}
+
+void MetricsServer::stop(MetricsServer *server)
+{
+    if (!server)
+        return;
+
+    QThread *thread = server->m_thread;
+
+    thread->quit();
+    thread->wait();
+
+    delete server;
+    delete thread;
+}
+
+void MetricsServer::listen()
+{
+    const QStringList parts = m_address.split(':');
+    bool isPort = false;
+    const quint16 port = parts.last().toUShort(&isPort);
+
+    if (isPort && parts.size() <= 2)
+    {
+        const QHostAddress host = parts.size() == 2 ? QHostAddress(parts.first()) : QHostAddress(QHostAddress::LocalHost);
+
+        m_tcp = new QTcpServer(this);
+        connect(m_tcp, SIGNAL(newConnection()), this, SLOT(newTcpConnection()));
+
+        if (!m_tcp->listen(host, port))
+            qWarning() << "metrics: cannot listen on" << m_address << m_tcp->errorString();
+        else
+            qDebug() << "metrics: serving on" << host.toString() << port;
+        return;
+    }
+
+    m_local = new QLocalServer(this);
+    m_local->setSocketOptions(QLocalServer::UserAccessOption);
+    connect(m_local, SIGNAL(newConnection()), this, SLOT(newLocalConnection()));
+
+    QLocalServer::removeServer(m_address);
+    if (!m_local->listen(m_address))
+        qWarning() << "metrics: cannot listen on" << m_address << m_local->errorString();
+    else
+        qDebug() << "metrics: serving on" << m_local->fullServerName();
+}
+
+void MetricsServer::newTcpConnection()
+{
+    while (QTcpSocket *socket = m_tcp->nextPendingConnection())
+        accept(socket);
+}
+
+void MetricsServer::newLocalConnection()
+{
+    while (QLocalSocket *socket = m_local->nextPendingConnection())
+        accept(socket);
+}
+
+void MetricsServer::accept(QIODevice *socket)
+{
+    connect(socket, SIGNAL(readyRead()), this, SLOT(readRequest()));
+    connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+
+    // idle or trickling clients would otherwise hold a socket forever
+    QTimer *timer = new QTimer(socket);
+    timer->setSingleShot(true);
+    connect(timer, SIGNAL(timeout()), this, SLOT(requestTimeout()));
+    timer->start(REQUEST_TIMEOUT_MS);
+}
+
+void MetricsServer::requestTimeout()
+{
+    QIODevice *socket = qobject_cast<QIODevice *>(sender()->parent());
+    if (!socket)
+        return;
+
+    if (QTcpSocket *tcp = qobject_cast<QTcpSocket *>(socket))
+        tcp->abort();
+    else if (QLocalSocket *local = qobject_cast<QLocalSocket *>(socket))
+        local->abort();
+
+    socket->deleteLater();
+}
+
+void MetricsServer::readRequest()
+{
+    QIODevice *socket = qobject_cast<QIODevice *>(sender());
+    if (!socket)
+        return;
+
+    const QByteArray request = socket->property("request").toByteArray() + socket->readAll();
+
+    // answer once the request header is complete, the body is ignored
+    if (!request.contains("\r\n\r\n") && !request.contains("\n\n") && request.size() < 8192)
+    {
+        socket->setProperty("request", request);
+        return;
+    }
+
+    socket->setProperty("request", QVariant());
+    disconnect(socket, SIGNAL(readyRead()), this, SLOT(readRequest()));
+
+    serve(socket);
+}
+
+void MetricsServer::serve(QIODevice *socket)
+{
+    const QByteArray body = BleMetrics::exposition();
+
+    QByteArray response;
+    response.reserve(body.size() + 128);
+    response += "HTTP/1.0 200 OK\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: ";
+    response += QByteArray::number(body.size());
+    response += "\r\nConnection: close\r\n\r\n";
+    response += body;
+
+    socket->write(response);
+
+    if (QTcpSocket *tcp = qobject_cast<QTcpSocket *>(socket))
+        tcp->disconnectFromHost();
+    else if (QLocalSocket *local = qobject_cast<QLocalSocket *>(socket))
+        local->disconnectFromServer();
+}
@@ -0,0 +1,97 @@
+#ifndef BLEMETRICS_H
+#define BLEMETRICS_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QString>
+
+#include <atomic>
+
+class QThread;
+class QTcpServer;
+class QLocalServer;
+class QIODevice;
+
+// Runtime counters and gauges of the BLE core.
+//
+// Counters live in per-thread slots (one cache line each), so the hot path
+// is a relaxed atomic add on memory no other thread writes. Readers sum the
+// slots; nothing here ever takes a lock or touches the GUI thread.
+class BleMetrics
+{
+public:
+    enum Counter {
+        WritesSent,
+        WritesCoalesced,
+        BytesOut,
+        BytesIn,
+        ParseFailures,
+        Reconnects,
+        ScanCycles,
+        CounterCount
+    };
+
+    enum Gauge {
+        ConnectionIntervalUs,
+        QueueDepth,
+        LinkRttMs,
+        FirstControlMs,
+        GaugeCount
+    };
+
+    static void add(Counter c, quint64 value = 1);
+    static void set(Gauge g, qint64 value);
+
+    static quint64 counter(Counter c);
+    static qint64 gauge(Gauge g);
+
+    // Prometheus text exposition format 0.0.4
+    static QByteArray exposition();
+
+private:
+    enum { MaxSlots = 16 };
+
+    struct alignas(64) Slot
+    {
+        std::atomic<quint64> counters[CounterCount];
+    };
+
+    static Slot &slot();
+
+    static Slot s_slots[MaxSlots];
+    static std::atomic<int> s_nextSlot;
+    static std::atomic<qint64> s_gauges[GaugeCount];
+};
+
+
+// Serves BleMetrics::exposition() over HTTP on a loopback TCP port or a
+// local (Unix domain) socket, from its own thread.
+class MetricsServer: public QObject
+{
+    Q_OBJECT
+
+public:
+    // "9464" / "127.0.0.1:9464" -> loopback TCP, anything else -> local socket name/path
+    static MetricsServer *start(const QString &address);
+    static void stop(MetricsServer *server);
+
+private slots:
+    void listen();
+    void newTcpConnection();
+    void newLocalConnection();
+    void readRequest();
+    void requestTimeout();
+
+private:
+    explicit MetricsServer(const QString &address);
+
+    void accept(QIODevice *socket);
+    void serve(QIODevice *socket);
+
+    QString m_address;
+    QThread *m_thread;
+    QTcpServer *m_tcp;
+    QLocalServer *m_local;
+};
+
+#endif // BLEMETRICS_H
@@ -0,0 +1,145 @@
+#include "configsnapshot.h"
+
+#include <cstring>
+
+// bytes of a state layout frame a record starts at
+#define RECORD_OFFSET 2
+
+
+ConfigSnapshot::ConfigSnapshot():
+    m_crc(0), m_computed(0), m_styles(0)
+{
+}
+
+void ConfigSnapshot::clear()
+{
+    m_crc = 0;
+    m_computed = 0;
+    m_styles = 0;
+    m_records.clear();
+    m_received.clear();
+    m_edited.clear();
+}
+
+void ConfigSnapshot::begin(quint32 crc, int styles)
+{
+    m_crc = crc;
+    m_computed = 0;
+    m_styles = qBound(0, styles, int(MaxStyles));
+    m_records.fill(0, m_styles * RecordSize);
+    m_received = QBitArray(m_styles);
+    m_edited = QBitArray(m_styles);
+}
+
+bool ConfigSnapshot::applyRecord(const quint8 *frame, int size)
+{
+    if (size < RecordFrameSize || complete())
+        return false;
+
+    const int style = frame[ParamSchema::StyleOffset];
+    if (style >= m_styles || frame[RecordFrameSize - 1] != m_styles)
+        return false;
+
+    memcpy(m_records.data() + style * RecordSize, frame + RECORD_OFFSET, RecordSize);
+    m_received.setBit(style);
+
+    if (!complete())
+        return false;
+
+    update();
+    return true;
+}
+
+bool ConfigSnapshot::complete() const
+{
+    return m_styles > 0 && m_received.count(true) == m_styles;
+}
+
+bool ConfigSnapshot::styleParams(int style, int *values) const
+{
+    if (!valid() || style < 0 || style >= m_styles || m_edited.testBit(style))
+        return false;
+
+    quint8 frame[ParamSchema::StateFrameSize];
+    memcpy(frame + RECORD_OFFSET, m_records.constData() + style * RecordSize, RecordSize);
+    ParamSchema::decodeState(frame, values);
+    return true;
+}
+
+bool ConfigSnapshot::markEdited(int style, const int *values)
+{
+    if (!valid() || style < 0 || style >= m_styles || m_edited.testBit(style))
+        return false;
+
+    quint8 frame[ParamSchema::StateFrameSize];
+    ParamSchema::encodeState(values, frame);
+    frame[ParamSchema::StyleOffset] = quint8(style);
+
+    // whether and how the device stores the edit is up to the firmware, so
+    // the record is left alone and the CRC it reports decides
+    if (!memcmp(m_records.constData() + style * RecordSize, frame + RECORD_OFFSET, RecordSize))
+        return false;
+
+    m_edited.setBit(style);
+    return true;
+}
+
+bool ConfigSnapshot::restore(quint32 crc, const QByteArray &records)
+{
+    const int styles = records.size() / RecordSize;
+    if (!styles || styles > MaxStyles || records.size() != styles * RecordSize)
+        return false;
+
+    m_crc = crc;
+    m_styles = styles;
+    m_records = records;
+    m_received = QBitArray(styles, true);
+    m_edited = QBitArray(styles);
+    update();
+
+    return valid();
+}
+
+QByteArray ConfigSnapshot::recordFrame(int style) const
+{
+    QByteArray frame(RecordFrameSize, 0);
+    frame[0] = 0x06;
+    frame[1] = char(0x82);
+    memcpy(frame.data() + RECORD_OFFSET, m_records.constData() + style * RecordSize, RecordSize);
+    frame[RecordFrameSize - 1] = char(m_styles);
+    return frame;
+}
+
+void ConfigSnapshot::update()
+{
+    m_computed = crc32(reinterpret_cast<const quint8 *>(m_records.constData()), m_records.size());
+}
+
+namespace {
+struct Crc32Table
+{
+    quint32 entry[256];
+
+    Crc32Table()
+    {
+        for (quint32 i = 0; i < 256; i++)
+        {
+            quint32 c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            entry[i] = c;
+        }
+    }
+};
+}
+
+// CRC-32 (IEEE 802.3, reflected 0xEDB88320), as zlib computes it
+quint32 ConfigSnapshot::crc32(const quint8 *data, int size)
+{
+    static const Crc32Table table;
+
+    quint32 crc = 0xFFFFFFFFu;
+    for (int i = 0; i < size; i++)
+        crc = table.entry[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
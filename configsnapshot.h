@@ -0,0 +1,71 @@
+#ifndef CONFIGSNAPSHOT_H
+#define CONFIGSNAPSHOT_H
+
+#include "paramschema.h"
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QBitArray>
+
+// Parameters of every sound style, as fetched in one bulk dump.
+//
+//   0x05 0x01              -> 0x05 0x81 crc32[4] styles
+//   0x05 0x02              -> 0x06 0x82 <state layout, style at 11> styles,
+//                             one frame per style
+//
+// The CRC-32 covers the records (state frame bytes 2..11) in style order,
+// so a cached copy that still matches the device after reconnect lets the
+// dump be skipped. Records only ever hold what the device sent: a style
+// whose live values differ is marked unconfirmed until the next dump.
+class ConfigSnapshot
+{
+public:
+    enum {
+        RecordSize = ParamSchema::StyleOffset - 1,      // params + style byte
+        RecordFrameSize = ParamSchema::StateFrameSize + 1,
+        MaxStyles = 64
+    };
+
+    ConfigSnapshot();
+
+    void clear();
+
+    // start collecting a dump announced by the CRC reply
+    void begin(quint32 crc, int styles);
+
+    // one 0x06 0x82 frame, true once the last missing record arrived
+    bool applyRecord(const quint8 *frame, int size);
+
+    bool complete() const;
+    bool valid() const { return complete() && m_computed == m_crc; }
+
+    quint32 crc() const { return m_crc; }
+    int styleCount() const { return m_styles; }
+
+    // false for styles edited since the dump
+    bool styleParams(int style, int *values) const;
+
+    // live values of style from a state frame; true if they newly differ
+    // from the record, i.e. the table should be queried again
+    bool markEdited(int style, const int *values);
+
+    // cached form: records in style order
+    QByteArray records() const { return m_records; }
+    bool restore(quint32 crc, const QByteArray &records);
+
+    QByteArray recordFrame(int style) const;
+
+    static quint32 crc32(const quint8 *data, int size);
+
+private:
+    void update();
+
+    quint32 m_crc;
+    quint32 m_computed;
+    int m_styles;
+    QByteArray m_records;
+    QBitArray m_received;
+    QBitArray m_edited;
+};
+
+#endif // CONFIGSNAPSHOT_H
@@ -0,0 +1,362 @@
+#include "devicemodel.h"
+#include "deviceinfo.h"
+
+#include <QDateTime>
+#include <QQmlEngine>
+#include <QBluetoothAddress>
+#include <QBluetoothUuid>
+
+DeviceModel::DeviceModel(QObject *parent):
+    QAbstractListModel(parent)
+{
+    // index 0 is the empty name, which most advertisers use
+    intern(QString());
+}
+
+int DeviceModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_order.size();
+}
+
+QVariant DeviceModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_order.size())
+        return QVariant();
+
+    const Record &r = m_pool.at(m_order.at(index.row()));
+
+    switch (role) {
+    case NameRole:
+    case Qt::DisplayRole:
+        return m_names.at(r.nameId);
+    case AddressRole:
+        return keyToString(r.key);
+    case RssiRole:
+        return r.rssi;
+    case LastSeenRole:
+        return QDateTime::fromMSecsSinceEpoch(r.lastSeen);
+    default:
+        return QVariant();
+    }
+}
+
+QHash<int, QByteArray> DeviceModel::roleNames() const
+{
+    QHash<int, QByteArray> roles;
+    roles[NameRole] = "deviceName";
+    roles[AddressRole] = "deviceAddress";
+    roles[RssiRole] = "rssi";
+    roles[LastSeenRole] = "lastSeen";
+    return roles;
+}
+
+QString DeviceModel::addressOf(const QBluetoothDeviceInfo &info)
+{
+#ifdef Q_OS_MAC
+    // workaround for Core Bluetooth:
+    return info.deviceUuid().toString();
+#else
+    return info.address().toString();
+#endif
+}
+
+
+//---------------------------------------------------//
+
+#ifdef Q_OS_MAC
+static DeviceKey uuidToKey(const QBluetoothUuid &uuid)
+{
+    const quint128 u = uuid.toUInt128();
+
+    DeviceKey key;
+    key.hi = 0;
+    key.lo = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        key.hi = (key.hi << 8) | u.data[i];
+        key.lo = (key.lo << 8) | u.data[i + 8];
+    }
+    return key;
+}
+
+static QBluetoothUuid keyToUuid(const DeviceKey &key)
+{
+    quint128 u;
+    for (int i = 0; i < 8; i++)
+    {
+        u.data[i] = quint8(key.hi >> (56 - 8 * i));
+        u.data[i + 8] = quint8(key.lo >> (56 - 8 * i));
+    }
+    return QBluetoothUuid(u);
+}
+#endif
+
+DeviceKey DeviceModel::keyOf(const QBluetoothDeviceInfo &info)
+{
+#ifdef Q_OS_MAC
+    return uuidToKey(info.deviceUuid());
+#else
+    DeviceKey key;
+    key.hi = 0;
+    key.lo = info.address().toUInt64();
+    return key;
+#endif
+}
+
+bool DeviceModel::keyFromString(const QString &address, DeviceKey &key)
+{
+#ifdef Q_OS_MAC
+    const QBluetoothUuid uuid(address);
+    if (uuid.isNull())
+        return false;
+
+    key = uuidToKey(uuid);
+#else
+    const QBluetoothAddress addr(address);
+    if (addr.isNull())
+        return false;
+
+    key.hi = 0;
+    key.lo = addr.toUInt64();
+#endif
+    return true;
+}
+
+QString DeviceModel::keyToString(const DeviceKey &key)
+{
+#ifdef Q_OS_MAC
+    return keyToUuid(key).toString();
+#else
+    return QBluetoothAddress(key.lo).toString();
+#endif
+}
+
+quint32 DeviceModel::intern(const QString &name)
+{
+    QHash<QString, quint32>::const_iterator it = m_nameIds.constFind(name);
+    if (it != m_nameIds.constEnd())
+        return it.value();
+
+    const quint32 id = m_names.size();
+    m_names.append(name);
+    m_nameIds.insert(name, id);
+    return id;
+}
+
+// Renumbers the names still used by a row; the rest are released, so the
+// table follows the devices in range rather than every name ever seen.
+void DeviceModel::compactNames()
+{
+    QVector<quint32> remap(m_names.size(), 0);     // old id -> new id + 1
+    QVector<QString> names;
+
+    // id 0 stays the empty name
+    names.append(QString());
+    remap[0] = 1;
+
+    for (int i = 0; i < m_order.size(); i++)
+    {
+        Record &r = m_pool[m_order.at(i)];
+        if (!remap.at(r.nameId))
+        {
+            names.append(m_names.at(r.nameId));
+            remap[r.nameId] = names.size();
+        }
+        r.nameId = remap.at(r.nameId) - 1;
+    }
+
+    m_names = names;
+    m_nameIds.clear();
+    for (int i = 0; i < m_names.size(); i++)
+        m_nameIds.insert(m_names.at(i), i);
+}
+
+
+//---------------------------------------------------//
+
+int DeviceModel::upsert(const QBluetoothDeviceInfo &info)
+{
+    const DeviceKey key = keyOf(info);
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    QHash<DeviceKey, quint32>::const_iterator it = m_slots.constFind(key);
+
+    if (it == m_slots.constEnd())
+    {
+        quint32 slot;
+        if (!m_free.isEmpty())
+        {
+            slot = m_free.last();
+            m_free.removeLast();
+        }
+        else
+        {
+            slot = m_pool.size();
+            m_pool.resize(slot + 1);
+        }
+
+        const int row = m_order.size();
+
+        beginInsertRows(QModelIndex(), row, row);
+        Record &r = m_pool[slot];
+        r.key = key;
+        r.lastSeen = now;
+        r.nameId = intern(info.name());
+        r.row = row;
+        r.rssi = info.rssi();
+        m_order.append(slot);
+        m_slots.insert(key, slot);
+        endInsertRows();
+
+        Q_EMIT countChanged();
+        return row;
+    }
+
+    Record &r = m_pool[it.value()];
+
+    // one prebuilt role list per combination, repeat adverts build nothing
+    static const QVector<int> changedRoles[4] = {
+        QVector<int>() << LastSeenRole,
+        QVector<int>() << LastSeenRole << NameRole << Qt::DisplayRole,
+        QVector<int>() << LastSeenRole << RssiRole,
+        QVector<int>() << LastSeenRole << NameRole << Qt::DisplayRole << RssiRole
+    };
+    int changed = 0;
+
+    // cheap compare against the interned string before touching the name table
+    const QString name = info.name();
+    if (m_names.at(r.nameId) != name)
+    {
+        r.nameId = intern(name);
+        changed |= 1;
+    }
+
+    if (r.rssi != info.rssi())
+    {
+        r.rssi = info.rssi();
+        changed |= 2;
+    }
+
+    r.lastSeen = now;
+
+    const QModelIndex idx = index(r.row);
+    Q_EMIT dataChanged(idx, idx, changedRoles[changed]);
+
+    return r.row;
+}
+
+void DeviceModel::removeStale(qint64 maxAgeMs)
+{
+    const qint64 limit = QDateTime::currentMSecsSinceEpoch() - maxAgeMs;
+    int first = -1;
+    int lowest = -1;
+
+    // walk backwards so removing a run does not shift the rows still to visit
+    for (int row = m_order.size() - 1; row >= -1; row--)
+    {
+        const bool stale = row >= 0 && m_pool.at(m_order.at(row)).lastSeen < limit;
+
+        if (stale && first < 0)
+            first = row;
+
+        if (!stale && first >= 0)
+        {
+            beginRemoveRows(QModelIndex(), row + 1, first);
+            for (int i = row + 1; i <= first; i++)
+            {
+                const quint32 slot = m_order.at(i);
+                m_slots.remove(m_pool.at(slot).key);
+                m_pool[slot].row = -1;
+                m_free.append(slot);
+            }
+            m_order.remove(row + 1, first - row);
+            endRemoveRows();
+
+            lowest = row + 1;
+            first = -1;
+        }
+    }
+
+    if (lowest < 0)
+        return;
+
+    // only rows behind the first removed one moved
+    for (int i = lowest; i < m_order.size(); i++)
+        m_pool[m_order.at(i)].row = i;
+
+    compactNames();
+
+    Q_EMIT countChanged();
+}
+
+void DeviceModel::clear()
+{
+    if (m_order.isEmpty())
+        return;
+
+    beginResetModel();
+    m_pool.clear();
+    m_free.clear();
+    m_order.clear();
+    m_slots.clear();
+    m_names.clear();
+    m_nameIds.clear();
+    intern(QString());
+    endResetModel();
+
+    Q_EMIT countChanged();
+}
+
+int DeviceModel::indexOf(const QString &address) const
+{
+    DeviceKey key;
+    if (!keyFromString(address, key))
+        return -1;
+
+    QHash<DeviceKey, quint32>::const_iterator it = m_slots.constFind(key);
+    if (it == m_slots.constEnd())
+        return -1;
+
+    return m_pool.at(it.value()).row;
+}
+
+QBluetoothDeviceInfo DeviceModel::device(int row) const
+{
+    if (row < 0 || row >= m_order.size())
+        return QBluetoothDeviceInfo();
+
+    const Record &r = m_pool.at(m_order.at(row));
+
+#ifdef Q_OS_MAC
+    QBluetoothDeviceInfo info(keyToUuid(r.key), m_names.at(r.nameId), 0);
+#else
+    QBluetoothDeviceInfo info(QBluetoothAddress(r.key.lo), m_names.at(r.nameId), 0);
+#endif
+    info.setCoreConfigurations(QBluetoothDeviceInfo::LowEnergyCoreConfiguration);
+    info.setRssi(r.rssi);
+    return info;
+}
+
+QObject *DeviceModel::deviceAt(int row) const
+{
+    if (row < 0 || row >= m_order.size())
+        return 0;
+
+    DeviceInfo *info = new DeviceInfo(device(row));
+    QQmlEngine::setObjectOwnership(info, QQmlEngine::JavaScriptOwnership);
+    return info;
+}
+
+qint64 DeviceModel::memoryFootprint() const
+{
+    qint64 bytes = m_pool.capacity() * sizeof(Record)
+                 + m_free.capacity() * sizeof(quint32)
+                 + m_order.capacity() * sizeof(quint32)
+                 + m_slots.capacity() * (sizeof(DeviceKey) + sizeof(quint32) + 2 * sizeof(void*))
+                 + m_nameIds.capacity() * (sizeof(QString) + sizeof(quint32) + 2 * sizeof(void*));
+
+    for (int i = 0; i < m_names.size(); i++)
+        bytes += sizeof(QString) + m_names.at(i).size() * sizeof(QChar);
+
+    return bytes;
+}
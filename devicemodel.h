@@ -0,0 +1,97 @@
+#ifndef DEVICEMODEL_H
+#define DEVICEMODEL_H
+
+#include <QAbstractListModel>
+#include <QHash>
+#include <QVector>
+#include <QBluetoothDeviceInfo>
+
+// 128 bit device identity: BT address on Android/Linux, CoreBluetooth UUID on Apple
+struct DeviceKey
+{
+    quint64 hi;
+    quint64 lo;
+
+    bool operator==(const DeviceKey &o) const { return hi == o.hi && lo == o.lo; }
+};
+
+inline uint qHash(const DeviceKey &key, uint seed = 0)
+{
+    return qHash(key.hi ^ (key.lo * Q_UINT64_C(0x9E3779B97F4A7C15)), seed);
+}
+
+// Discovered LE devices, keyed by address. Scans only touch the rows that
+// were added, changed or went stale, so views update incrementally.
+//
+// Devices are plain records in one pooled vector (freed slots are reused)
+// with interned names; a DeviceInfo object is only built on demand for the
+// device being displayed. device() is a lossy rebuild (address, name, RSSI):
+// connecting prefers the discovery agent's own record.
+class DeviceModel: public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(int count READ count NOTIFY countChanged)
+
+public:
+    enum Roles {
+        NameRole = Qt::UserRole + 1,
+        AddressRole,
+        RssiRole,
+        LastSeenRole
+    };
+
+    explicit DeviceModel(QObject *parent = 0);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role) const;
+    QHash<int, QByteArray> roleNames() const;
+
+    // insert a new row or update the existing one, returns the row
+    int upsert(const QBluetoothDeviceInfo &info);
+
+    // drop rows not seen for maxAgeMs, and names no row uses any more
+    void removeStale(qint64 maxAgeMs);
+    void clear();
+
+    int count() const { return m_order.size(); }
+    int indexOf(const QString &address) const;
+    QBluetoothDeviceInfo device(int row) const;
+
+    // DeviceInfo wrapper for QML, owned by the JS engine
+    Q_INVOKABLE QObject *deviceAt(int row) const;
+
+    // bytes held by the pool, name table and indexes
+    qint64 memoryFootprint() const;
+
+    static QString addressOf(const QBluetoothDeviceInfo &info);
+
+signals:
+    void countChanged();
+
+private:
+    struct Record
+    {
+        DeviceKey key;
+        qint64 lastSeen;
+        quint32 nameId;
+        qint32 row;         // -1 while the slot is free
+        qint16 rssi;
+    };
+
+    static DeviceKey keyOf(const QBluetoothDeviceInfo &info);
+    static bool keyFromString(const QString &address, DeviceKey &key);
+    static QString keyToString(const DeviceKey &key);
+
+    quint32 intern(const QString &name);
+    void compactNames();
+
+    QVector<Record> m_pool;
+    QVector<quint32> m_free;
+    QVector<quint32> m_order;       // row -> pool slot
+    QHash<DeviceKey, quint32> m_slots;
+
+    QVector<QString> m_names;
+    QHash<QString, quint32> m_nameIds;
+};
+
+#endif // DEVICEMODEL_H
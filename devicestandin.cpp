@@ -0,0 +1,224 @@
+#include "devicestandin.h"
+#include "streamtransport.h"
+
+#include <QDebug>
+#include <QUrl>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QHostAddress>
+
+
+DeviceStandIn::DeviceStandIn(QObject *parent):
+    QObject(parent), m_tcp(0), m_local(0), m_style(0), m_version(12), m_frames(0)
+{
+    for (int i = 0; i < ParamCount; i++)
+        m_params[i] = (ParamSchema::params[i].minimum + ParamSchema::params[i].maximum) / 2;
+    m_params[ParamOnOff] = 1;
+
+    // every style starts from the defaults, with its own volume
+    QByteArray records;
+    for (int style = 0; style < StyleCount; style++)
+    {
+        m_params[ParamVolume] = 40 + style * 5;
+
+        QByteArray frame(ParamSchema::StateFrameSize, 0);
+        ParamSchema::encodeState(m_params, reinterpret_cast<quint8 *>(frame.data()));
+        frame[ParamSchema::StyleOffset] = char(style);
+        records += frame.mid(2, ConfigSnapshot::RecordSize);
+    }
+    m_config.restore(ConfigSnapshot::crc32(reinterpret_cast<const quint8 *>(records.constData()), records.size()), records);
+    m_config.styleParams(m_style, m_params);
+}
+
+// like the firmware: settings are written back to the current style and
+// the table CRC follows
+void DeviceStandIn::storeStyle()
+{
+    QByteArray frame(ParamSchema::StateFrameSize, 0);
+    ParamSchema::encodeState(m_params, reinterpret_cast<quint8 *>(frame.data()));
+    frame[ParamSchema::StyleOffset] = char(m_style);
+
+    QByteArray records = m_config.records();
+    records.replace(m_style * ConfigSnapshot::RecordSize, ConfigSnapshot::RecordSize, frame.mid(2, ConfigSnapshot::RecordSize));
+    m_config.restore(ConfigSnapshot::crc32(reinterpret_cast<const quint8 *>(records.constData()), records.size()), records);
+}
+
+bool DeviceStandIn::listen(const QString &url)
+{
+    if (url.startsWith("tcp://"))
+    {
+        const QUrl u(url);
+
+        m_tcp = new QTcpServer(this);
+        connect(m_tcp, SIGNAL(newConnection()), this, SLOT(newConnection()));
+
+        if (!m_tcp->listen(QHostAddress(u.host()), quint16(u.port())))
+        {
+            qWarning() << "stand-in: cannot listen on" << url << m_tcp->errorString();
+            return false;
+        }
+        return true;
+    }
+
+    const QString name = url.mid(url.indexOf(':') + 1);
+
+    m_local = new QLocalServer(this);
+    connect(m_local, SIGNAL(newConnection()), this, SLOT(newConnection()));
+
+    QLocalServer::removeServer(name);
+    if (!m_local->listen(name))
+    {
+        qWarning() << "stand-in: cannot listen on" << url << m_local->errorString();
+        return false;
+    }
+    return true;
+}
+
+void DeviceStandIn::newConnection()
+{
+    for (;;)
+    {
+        QIODevice *client = 0;
+
+        if (m_tcp && m_tcp->hasPendingConnections())
+        {
+            QTcpSocket *socket = m_tcp->nextPendingConnection();
+            socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+            connect(socket, SIGNAL(disconnected()), this, SLOT(clientGone()));
+            client = socket;
+        }
+        else if (m_local && m_local->hasPendingConnections())
+        {
+            QLocalSocket *socket = m_local->nextPendingConnection();
+            connect(socket, SIGNAL(disconnected()), this, SLOT(clientGone()));
+            client = socket;
+        }
+        else
+            break;
+
+        connect(client, SIGNAL(readyRead()), this, SLOT(readClient()));
+        m_pending.insert(client, QByteArray());
+        qDebug() << "stand-in: client connected";
+    }
+}
+
+void DeviceStandIn::clientGone()
+{
+    QIODevice *client = qobject_cast<QIODevice *>(sender());
+    m_pending.remove(client);
+    client->deleteLater();
+}
+
+void DeviceStandIn::readClient()
+{
+    QIODevice *client = qobject_cast<QIODevice *>(sender());
+    if (!client)
+        return;
+
+    QByteArray &buffer = m_pending[client];
+    buffer += client->readAll();
+
+    QByteArray out;
+    QList<QByteArray> replies;
+    int pos = 0;
+    int length;
+
+    while ((length = StreamTransport::frameLength(buffer.constData() + pos, buffer.size() - pos)) >= 0)
+    {
+        replies.clear();
+        handleFrame(reinterpret_cast<const quint8 *>(buffer.constData()) + pos + 1, length, replies);
+
+        for (int i = 0; i < replies.size(); i++)
+        {
+            out += char(replies.at(i).size());
+            out += replies.at(i);
+        }
+        pos += 1 + length;
+    }
+
+    buffer.remove(0, pos);
+
+    if (!out.isEmpty())
+        client->write(out);
+}
+
+QByteArray DeviceStandIn::stateFrame(quint8 type) const
+{
+    QByteArray frame(ParamSchema::StateFrameSize, 0);
+    frame[0] = char(type);
+    frame[1] = 0x13;
+    ParamSchema::encodeState(m_params, reinterpret_cast<quint8 *>(frame.data()));
+    frame[ParamSchema::StyleOffset] = char(m_style);
+    return frame;
+}
+
+void DeviceStandIn::handleFrame(const quint8 *data, int size, QList<QByteArray> &replies)
+{
+    if (size < 2)
+        return;
+
+    m_frames++;
+
+    const quint8 type = data[0];
+    const quint8 cmd = data[1];
+
+    if (type == 0x01)                               // mode request
+        replies << stateFrame(0x01);
+
+    else if (type == 0x02 && cmd == 0x13 && size >= ParamSchema::StateFrameSize - 1)
+    {
+        ParamSchema::decodeState(data, m_params);
+        storeStyle();
+        replies << stateFrame(0x02);
+    }
+
+    else if (type == 0x03 && size >= 3)             // style select
+    {
+        if (data[2] < m_config.styleCount())
+        {
+            m_style = data[2];
+            m_config.styleParams(m_style, m_params);
+        }
+        replies << stateFrame(0x03);
+    }
+
+    else if (type == 0xAB && cmd == 0xCD)           // version
+    {
+        QByteArray frame(4, 0);
+        frame[0] = char(0xAB);
+        frame[1] = char(0xDC);
+        frame[2] = char(m_version >> 8);
+        frame[3] = char(m_version);
+        replies << frame;
+    }
+
+    else if (type == 0x04 && cmd == 0x20 && size >= 5)  // EQ gains: report them back
+    {
+        QByteArray frame(reinterpret_cast<const char *>(data), size);
+        frame[1] = char(0xA0);
+        replies << frame;
+    }
+
+    else if (type == 0x05 && cmd == 0x01)           // style table CRC
+    {
+        const quint32 crc = m_config.crc();
+
+        QByteArray frame(7, 0);
+        frame[0] = 0x05;
+        frame[1] = char(0x81);
+        frame[2] = char(crc >> 24);
+        frame[3] = char(crc >> 16);
+        frame[4] = char(crc >> 8);
+        frame[5] = char(crc);
+        frame[6] = char(m_config.styleCount());
+        replies << frame;
+    }
+
+    else if (type == 0x05 && cmd == 0x02)           // style table dump
+    {
+        for (int style = 0; style < m_config.styleCount(); style++)
+            replies << m_config.recordFrame(style);
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef DEVICESTANDIN_H
+#define DEVICESTANDIN_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QByteArray>
+
+#include "paramschema.h"
+#include "configsnapshot.h"
+
+class QTcpServer;
+class QLocalServer;
+class QIODevice;
+
+// Minimal DSP firmware model behind a StreamTransport address, so the app
+// (or a benchmark) can run the real protocol at full rate without a radio.
+// Answers mode/settings/style requests with 0x13 state frames, the version
+// request with 0xAB 0xDC, EQ band writes with 0x04 0xA0 reports and the
+// style table requests with its CRC or a 0x06 0x82 dump.
+class DeviceStandIn: public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DeviceStandIn(QObject *parent = 0);
+
+    // same address forms as StreamTransport::open()
+    bool listen(const QString &url);
+
+    quint64 framesHandled() const { return m_frames; }
+
+    // replies to one frame appended to `replies`, none if it needs no answer
+    void handleFrame(const quint8 *data, int size, QList<QByteArray> &replies);
+
+private slots:
+    void newConnection();
+    void readClient();
+    void clientGone();
+
+private:
+    QByteArray stateFrame(quint8 type) const;
+    void storeStyle();
+
+    QTcpServer *m_tcp;
+    QLocalServer *m_local;
+    QHash<QIODevice *, QByteArray> m_pending;
+
+    enum { StyleCount = 11 };
+
+    int m_params[ParamCount];
+    int m_style;
+    ConfigSnapshot m_config;
+    quint16 m_version;
+    quint64 m_frames;
+};
+
+#endif // DEVICESTANDIN_H
@@ -0,0 +1,470 @@
+#include "dspengine.h"
+#include "simd4.h"
+
+#include <QFile>
+#include <QElapsedTimer>
+#include <QtEndian>
+#include <QtMath>
+
+#include <complex>
+#include <cstring>
+
+// Centre frequencies of the device tone stack
+#define BASS_FREQ       100.0
+#define MIDDLE_FREQ     1000.0
+#define TREBLE_FREQ     8000.0
+#define SHELF_Q         0.707
+#define MIDDLE_Q        0.7
+
+// +-12 dB around the slider centre
+#define TONE_RANGE_DB   12.0
+
+
+DspEngine::DspEngine(double sampleRate, int channels):
+    m_sampleRate(sampleRate), m_channels(qMax(1, channels)), m_gain(1.0f)
+{
+    m_params.on_off = 1;
+    m_params.volume = 0;
+    m_params.bass = 0;
+    m_params.middle = 0;
+    m_params.treble = 0;
+
+    updateCoeffs();
+    reset();
+}
+
+void DspEngine::setSampleRate(double sampleRate)
+{
+    m_sampleRate = sampleRate;
+    updateCoeffs();
+    reset();
+}
+
+void DspEngine::setChannels(int channels)
+{
+    m_channels = qMax(1, channels);
+    reset();
+}
+
+void DspEngine::setParams(const DspParams &params)
+{
+    m_params = params;
+    updateCoeffs();
+}
+
+void DspEngine::reset()
+{
+    const int groups = (m_channels + Lanes - 1) / Lanes;
+    m_state.fill(0.0f, groups * StageCount * 2 * Lanes);
+}
+
+
+//---------------------------------------------------//
+
+double DspEngine::volumeToDb(int volume)
+{
+    if (volume <= 0)
+        return -120.0;
+
+    // 0..100 -> -60..0 dB
+    return (qMin(volume, 100) - 100) * 0.6;
+}
+
+double DspEngine::bassToDb(int bass)
+{
+    // CurrentSound.qml sends slider value * 40
+    return (qBound(0, bass, 4000) / 40.0 - 50.0) * TONE_RANGE_DB / 50.0;
+}
+
+double DspEngine::middleToDb(int middle)
+{
+    return (qBound(0, middle, 100) - 50.0) * TONE_RANGE_DB / 50.0;
+}
+
+double DspEngine::trebleToDb(int treble)
+{
+    return (qBound(0, treble, 4000) / 40.0 - 50.0) * TONE_RANGE_DB / 50.0;
+}
+
+
+// RBJ audio EQ cookbook
+BiquadCoeffs DspEngine::lowShelf(double fs, double f0, double gainDb, double q)
+{
+    const double A = qPow(10.0, gainDb / 40.0);
+    const double w0 = 2.0 * M_PI * f0 / fs;
+    const double cs = qCos(w0);
+    const double alpha = qSin(w0) / (2.0 * q);
+    const double sa = 2.0 * qSqrt(A) * alpha;
+
+    const double a0 = (A + 1) + (A - 1) * cs + sa;
+
+    BiquadCoeffs c;
+    c.b0 = A * ((A + 1) - (A - 1) * cs + sa) / a0;
+    c.b1 = 2 * A * ((A - 1) - (A + 1) * cs) / a0;
+    c.b2 = A * ((A + 1) - (A - 1) * cs - sa) / a0;
+    c.a1 = -2 * ((A - 1) + (A + 1) * cs) / a0;
+    c.a2 = ((A + 1) + (A - 1) * cs - sa) / a0;
+    return c;
+}
+
+BiquadCoeffs DspEngine::peaking(double fs, double f0, double gainDb, double q)
+{
+    const double A = qPow(10.0, gainDb / 40.0);
+    const double w0 = 2.0 * M_PI * f0 / fs;
+    const double cs = qCos(w0);
+    const double alpha = qSin(w0) / (2.0 * q);
+
+    const double a0 = 1 + alpha / A;
+
+    BiquadCoeffs c;
+    c.b0 = (1 + alpha * A) / a0;
+    c.b1 = -2 * cs / a0;
+    c.b2 = (1 - alpha * A) / a0;
+    c.a1 = -2 * cs / a0;
+    c.a2 = (1 - alpha / A) / a0;
+    return c;
+}
+
+BiquadCoeffs DspEngine::highShelf(double fs, double f0, double gainDb, double q)
+{
+    const double A = qPow(10.0, gainDb / 40.0);
+    const double w0 = 2.0 * M_PI * f0 / fs;
+    const double cs = qCos(w0);
+    const double alpha = qSin(w0) / (2.0 * q);
+    const double sa = 2.0 * qSqrt(A) * alpha;
+
+    const double a0 = (A + 1) - (A - 1) * cs + sa;
+
+    BiquadCoeffs c;
+    c.b0 = A * ((A + 1) + (A - 1) * cs + sa) / a0;
+    c.b1 = -2 * A * ((A - 1) + (A + 1) * cs) / a0;
+    c.b2 = A * ((A + 1) + (A - 1) * cs - sa) / a0;
+    c.a1 = 2 * ((A - 1) - (A + 1) * cs) / a0;
+    c.a2 = ((A + 1) - (A - 1) * cs - sa) / a0;
+    return c;
+}
+
+BiquadCoeffs DspEngine::stageCoeffs(int stage, const DspParams &params, double fs)
+{
+    const double nyq = fs * 0.45;
+
+    switch (stage) {
+    case 0:
+        return lowShelf(fs, qMin(BASS_FREQ, nyq), bassToDb(params.bass), SHELF_Q);
+    case 1:
+        return peaking(fs, qMin(MIDDLE_FREQ, nyq), middleToDb(params.middle), MIDDLE_Q);
+    default:
+        return highShelf(fs, qMin(TREBLE_FREQ, nyq), trebleToDb(params.treble), SHELF_Q);
+    }
+}
+
+double DspEngine::magnitudeDb(const BiquadCoeffs &c, double fs, double freq)
+{
+    const double w = 2.0 * M_PI * freq / fs;
+    const std::complex<double> z1 = std::polar(1.0, -w);
+    const std::complex<double> z2 = z1 * z1;
+
+    const std::complex<double> h = (double(c.b0) + double(c.b1) * z1 + double(c.b2) * z2)
+                                 / (1.0 + double(c.a1) * z1 + double(c.a2) * z2);
+    return 20.0 * std::log10(qMax(std::abs(h), 1e-6));
+}
+
+void DspEngine::updateCoeffs()
+{
+    for (int s = 0; s < StageCount; s++)
+        m_coeffs[s] = stageCoeffs(s, m_params, m_sampleRate);
+
+    if (!m_params.on_off || m_params.volume <= 0)
+        m_gain = 0.0f;
+    else
+        m_gain = qPow(10.0, volumeToDb(m_params.volume) / 20.0);
+}
+
+double DspEngine::responseDb(double freq) const
+{
+    if (m_gain == 0.0f)
+        return -120.0;
+
+    const double w = 2.0 * M_PI * freq / m_sampleRate;
+    const std::complex<double> z1 = std::polar(1.0, -w);
+    const std::complex<double> z2 = z1 * z1;
+
+    std::complex<double> h(m_gain, 0.0);
+
+    for (int s = 0; s < StageCount; s++)
+    {
+        const BiquadCoeffs &c = m_coeffs[s];
+        h *= (double(c.b0) + double(c.b1) * z1 + double(c.b2) * z2) / (1.0 + double(c.a1) * z1 + double(c.a2) * z2);
+    }
+
+    return 20.0 * std::log10(qMax(std::abs(h), 1e-6));
+}
+
+
+//---------------------------------------------------//
+
+void DspEngine::process(float *data, int frames)
+{
+    const int groups = (m_channels + Lanes - 1) / Lanes;
+
+    v4f b0[StageCount], b1[StageCount], b2[StageCount], a1[StageCount], a2[StageCount];
+    for (int s = 0; s < StageCount; s++)
+    {
+        b0[s] = v4_set1(m_coeffs[s].b0);
+        b1[s] = v4_set1(m_coeffs[s].b1);
+        b2[s] = v4_set1(m_coeffs[s].b2);
+        a1[s] = v4_set1(m_coeffs[s].a1);
+        a2[s] = v4_set1(m_coeffs[s].a2);
+    }
+    const v4f gain = v4_set1(m_gain);
+    const v4f dc = v4_set1(SIMD4_ANTI_DENORMAL);
+
+    V4DenormalGuard guard;
+    Q_UNUSED(guard);
+
+    for (int g = 0; g < groups; g++)
+    {
+        const int first = g * Lanes;
+        const int lanes = qMin(int(Lanes), m_channels - first);
+        float *state = m_state.data() + g * StageCount * 2 * Lanes;
+
+        v4f z1[StageCount], z2[StageCount];
+        for (int s = 0; s < StageCount; s++)
+        {
+            z1[s] = v4_load(state + (2 * s) * Lanes);
+            z2[s] = v4_load(state + (2 * s + 1) * Lanes);
+        }
+
+        float lane[Lanes] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        float *frame = data + first;
+
+        for (int f = 0; f < frames; f++, frame += m_channels)
+        {
+            for (int l = 0; l < lanes; l++)
+                lane[l] = frame[l];
+
+            v4f x = v4_add(v4_load(lane), dc);
+
+            // transposed direct form II, one stage after another
+            for (int s = 0; s < StageCount; s++)
+            {
+                const v4f y = v4_add(v4_mul(b0[s], x), z1[s]);
+                z1[s] = v4_sub(v4_add(v4_mul(b1[s], x), z2[s]), v4_mul(a1[s], y));
+                z2[s] = v4_sub(v4_mul(b2[s], x), v4_mul(a2[s], y));
+                x = y;
+            }
+
+            v4_store(lane, v4_mul(x, gain));
+
+            for (int l = 0; l < lanes; l++)
+                frame[l] = lane[l];
+        }
+
+        for (int s = 0; s < StageCount; s++)
+        {
+            v4_store(state + (2 * s) * Lanes, z1[s]);
+            v4_store(state + (2 * s + 1) * Lanes, z2[s]);
+        }
+    }
+}
+
+
+//---------------------------------------------------//
+
+bool DspEngine::readWav(const QString &path, QVector<float> &samples, int &channels, double &sampleRate, QString *error)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        if (error)
+            *error = file.errorString();
+        return false;
+    }
+
+    const QByteArray raw = file.readAll();
+    const uchar *d = reinterpret_cast<const uchar *>(raw.constData());
+
+    if (raw.size() < 12 || memcmp(d, "RIFF", 4) != 0 || memcmp(d + 8, "WAVE", 4) != 0)
+    {
+        if (error)
+            *error = QString::fromLocal8Bit("Not a RIFF/WAVE file");
+        return false;
+    }
+
+    quint16 format = 0, bits = 0;
+    channels = 0;
+    sampleRate = 0;
+
+    int pos = 12;
+    while (pos + 8 <= raw.size())
+    {
+        const quint32 chunkSize = qFromLittleEndian<quint32>(d + pos + 4);
+        const int body = pos + 8;
+
+        if (quint32(raw.size() - body) < chunkSize && memcmp(d + pos, "data", 4) != 0)
+            break;
+
+        if (memcmp(d + pos, "fmt ", 4) == 0 && chunkSize >= 16)
+        {
+            format = qFromLittleEndian<quint16>(d + body);
+            channels = qFromLittleEndian<quint16>(d + body + 2);
+            sampleRate = qFromLittleEndian<quint32>(d + body + 4);
+            bits = qFromLittleEndian<quint16>(d + body + 14);
+
+            // WAVE_FORMAT_EXTENSIBLE: real format in the sub-format GUID
+            if (format == 0xFFFE && chunkSize >= 26)
+                format = qFromLittleEndian<quint16>(d + body + 24);
+        }
+        else if (memcmp(d + pos, "data", 4) == 0)
+        {
+            if (!channels || !bits)
+                break;
+
+            if (bits < 8 || bits % 8 || sampleRate <= 0)
+            {
+                if (error)
+                    *error = QString("Unsupported WAV format %1 bit at %2 Hz").arg(bits).arg(sampleRate);
+                return false;
+            }
+
+            const int bytes = qMin<qint64>(chunkSize, raw.size() - body);
+            const int width = bits / 8;
+            const int count = bytes / width;
+            const uchar *p = d + body;
+
+            samples.resize(count - count % channels);
+
+            for (int i = 0; i < samples.size(); i++, p += width)
+            {
+                if (format == 3 && bits == 32)
+                {
+                    quint32 u = qFromLittleEndian<quint32>(p);
+                    float f;
+                    memcpy(&f, &u, sizeof(f));
+                    samples[i] = f;
+                }
+                else if (format == 1 && bits == 16)
+                    samples[i] = qFromLittleEndian<qint16>(p) / 32768.0f;
+                else if (format == 1 && bits == 24)
+                    samples[i] = (qint32((quint32(p[0]) << 8) | (quint32(p[1]) << 16) | (quint32(p[2]) << 24)) >> 8) / 8388608.0f;
+                else if (format == 1 && bits == 32)
+                    samples[i] = qFromLittleEndian<qint32>(p) / 2147483648.0f;
+                else
+                {
+                    if (error)
+                        *error = QString("Unsupported WAV format %1 / %2 bit").arg(format).arg(bits);
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        pos = body + chunkSize + (chunkSize & 1);
+    }
+
+    if (error)
+        *error = QString::fromLocal8Bit("No audio data found");
+    return false;
+}
+
+bool DspEngine::writeWav(const QString &path, const QVector<float> &samples, int channels, double sampleRate, QString *error)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        if (error)
+            *error = file.errorString();
+        return false;
+    }
+
+    const quint32 dataBytes = samples.size() * sizeof(float);
+
+    QByteArray header(44, 0);
+    uchar *h = reinterpret_cast<uchar *>(header.data());
+
+    memcpy(h, "RIFF", 4);
+    qToLittleEndian<quint32>(36 + dataBytes, h + 4);
+    memcpy(h + 8, "WAVE", 4);
+    memcpy(h + 12, "fmt ", 4);
+    qToLittleEndian<quint32>(16, h + 16);
+    qToLittleEndian<quint16>(3, h + 20);                                   // IEEE float
+    qToLittleEndian<quint16>(channels, h + 22);
+    qToLittleEndian<quint32>(quint32(sampleRate), h + 24);
+    qToLittleEndian<quint32>(quint32(sampleRate) * channels * 4, h + 28);
+    qToLittleEndian<quint16>(channels * 4, h + 32);
+    qToLittleEndian<quint16>(32, h + 34);
+    memcpy(h + 36, "data", 4);
+    qToLittleEndian<quint32>(dataBytes, h + 40);
+
+    file.write(header);
+
+    // samples are written as little endian IEEE floats
+    QByteArray body(dataBytes, 0);
+    uchar *b = reinterpret_cast<uchar *>(body.data());
+    for (int i = 0; i < samples.size(); i++, b += 4)
+    {
+        quint32 u;
+        memcpy(&u, &samples[i], sizeof(u));
+        qToLittleEndian<quint32>(u, b);
+    }
+
+    if (file.write(body) != body.size())
+    {
+        if (error)
+            *error = file.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+bool DspEngine::processWav(const QString &inPath, const QString &outPath, QString *error)
+{
+    QVector<float> samples;
+    int channels = 0;
+    double rate = 0;
+
+    if (!readWav(inPath, samples, channels, rate, error))
+        return false;
+
+    setSampleRate(rate);
+    setChannels(channels);
+
+    process(samples.data(), samples.size() / channels);
+
+    return writeWav(outPath, samples, channels, rate, error);
+}
+
+double DspEngine::benchmark(double seconds)
+{
+    const int blockFrames = 4096;
+    QVector<float> source(blockFrames * m_channels);
+    QVector<float> block(source.size());
+
+    // deterministic white noise
+    quint32 seed = 0x1234567;
+    for (int i = 0; i < source.size(); i++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        source[i] = (int(seed >> 9) - (1 << 22)) / float(1 << 22);
+    }
+
+    const qint64 totalFrames = qint64(seconds * m_sampleRate);
+    qint64 done = 0;
+
+    reset();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    while (done < totalFrames)
+    {
+        // every pass starts from the same noise, not the previous output
+        memcpy(block.data(), source.constData(), source.size() * sizeof(float));
+        process(block.data(), blockFrames);
+        done += blockFrames;
+    }
+
+    const qint64 ns = qMax<qint64>(timer.nsecsElapsed(), 1);
+    return double(done) * m_channels * 1e9 / ns;
+}
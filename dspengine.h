@@ -0,0 +1,85 @@
+#ifndef DSPENGINE_H
+#define DSPENGINE_H
+
+#include <QString>
+#include <QVector>
+
+// Parameter state as held by BLE and encoded by writeDelay()
+struct DspParams
+{
+    int on_off;
+    int volume;     // 0..100 (MASTER VOLUME slider)
+    int bass;       // 0..4000 (BASS slider value * 40)
+    int middle;     // 0..100 (MIDDLE slider)
+    int treble;     // 0..4000 (TREBLE slider value * 40)
+};
+
+struct BiquadCoeffs
+{
+    float b0, b1, b2, a1, a2;   // normalised, a0 == 1
+};
+
+// Reference model of the device chain: low shelf (bass), peaking (middle),
+// high shelf (treble), then master gain and mute. Channels are processed
+// in groups of four SIMD lanes (SSE / NEON, scalar fallback).
+class DspEngine
+{
+public:
+    enum { StageCount = 3, Lanes = 4 };
+
+    DspEngine(double sampleRate = 48000.0, int channels = 2);
+
+    void setSampleRate(double sampleRate);
+    double sampleRate() const { return m_sampleRate; }
+
+    void setChannels(int channels);
+    int channels() const { return m_channels; }
+
+    void setParams(const DspParams &params);
+    DspParams params() const { return m_params; }
+
+    void reset();
+
+    // interleaved float samples, frames * channels()
+    void process(float *data, int frames);
+
+    // magnitude response of the whole chain in dB at freq (Hz)
+    double responseDb(double freq) const;
+
+    // device value -> dB mappings used by setParams()
+    static double volumeToDb(int volume);
+    static double bassToDb(int bass);
+    static double middleToDb(int middle);
+    static double trebleToDb(int treble);
+
+    static BiquadCoeffs lowShelf(double fs, double f0, double gainDb, double q);
+    static BiquadCoeffs peaking(double fs, double f0, double gainDb, double q);
+    static BiquadCoeffs highShelf(double fs, double f0, double gainDb, double q);
+
+    // one stage of the tone stack (0 bass, 1 middle, 2 treble) for params
+    static BiquadCoeffs stageCoeffs(int stage, const DspParams &params, double fs);
+    static double magnitudeDb(const BiquadCoeffs &c, double fs, double freq);
+
+    // offline helpers
+    static bool readWav(const QString &path, QVector<float> &samples, int &channels, double &sampleRate, QString *error = 0);
+    static bool writeWav(const QString &path, const QVector<float> &samples, int channels, double sampleRate, QString *error = 0);
+    bool processWav(const QString &inPath, const QString &outPath, QString *error = 0);
+
+    // samples (frames * channels) processed per second over `seconds` of audio
+    double benchmark(double seconds = 60.0);
+
+private:
+    void updateCoeffs();
+
+    double m_sampleRate;
+    int m_channels;
+    DspParams m_params;
+
+    BiquadCoeffs m_coeffs[StageCount];
+    float m_gain;
+
+    // per lane group: z1, z2 for every stage
+    QVector<float> m_state;
+};
+
+#endif // DSPENGINE_H
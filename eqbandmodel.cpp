@@ -0,0 +1,346 @@
+#include "eqbandmodel.h"
+
+#include <QtMath>
+#include <QtAlgorithms>
+
+static const quint16 isoOctave[10] = {
+    31, 63, 125, 250, 500, 1000, 2000, 4000, 8000, 16000
+};
+
+static const quint16 isoThirdOctave[31] = {
+    20, 25, 31, 40, 50, 63, 80, 100, 125, 160, 200, 250, 315, 400, 500, 630,
+    800, 1000, 1250, 1600, 2000, 2500, 3150, 4000, 5000, 6300, 8000, 10000,
+    12500, 16000, 20000
+};
+
+// legacy bass / middle / treble centres, see DspEngine
+static const quint16 threeBand[3] = {
+    100, 1000, 8000
+};
+
+
+EqBandModel::EqBandModel(QObject *parent):
+    QAbstractListModel(parent), m_bands(0), m_channels(0)
+{
+}
+
+int EqBandModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_gain.size();
+}
+
+QVariant EqBandModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_gain.size())
+        return QVariant();
+
+    const int r = index.row();
+
+    switch (role) {
+    case GainRole:
+        return m_gain.at(r) / 10.0;
+    case FrequencyRole:
+        return m_freq.at(r);
+    case QRole:
+        return m_q.at(r) / 100.0;
+    case ChannelRole:
+        return r / m_bands;
+    case BandRole:
+        return r % m_bands;
+    default:
+        return QVariant();
+    }
+}
+
+bool EqBandModel::setData(const QModelIndex &index, const QVariant &value, int role)
+{
+    if (!index.isValid() || index.row() >= m_gain.size())
+        return false;
+
+    const int r = index.row();
+
+    switch (role) {
+    case GainRole:
+        setGain(r / m_bands, r % m_bands, value.toDouble());
+        return true;
+    case FrequencyRole:
+        setShape(r / m_bands, r % m_bands, value.toInt(), m_q.at(r) / 100.0);
+        return true;
+    case QRole:
+        setShape(r / m_bands, r % m_bands, m_freq.at(r), value.toDouble());
+        return true;
+    default:
+        return false;
+    }
+}
+
+Qt::ItemFlags EqBandModel::flags(const QModelIndex &index) const
+{
+    return QAbstractListModel::flags(index) | Qt::ItemIsEditable;
+}
+
+QHash<int, QByteArray> EqBandModel::roleNames() const
+{
+    QHash<int, QByteArray> roles;
+    roles[GainRole] = "gain";
+    roles[FrequencyRole] = "frequency";
+    roles[QRole] = "q";
+    roles[ChannelRole] = "channel";
+    roles[BandRole] = "band";
+    return roles;
+}
+
+
+//---------------------------------------------------//
+
+void EqBandModel::setLayout(int bands, int channels)
+{
+    bands = qBound(0, bands, int(MaxBands));
+    channels = qBound(0, channels, 255);
+
+    if (bands == m_bands && channels == m_channels)
+        return;
+
+    beginResetModel();
+
+    m_bands = bands;
+    m_channels = channels;
+
+    const int rows = bands * channels;
+    m_gain.fill(0, rows);
+    m_freq.resize(rows);
+    m_q.resize(rows);
+    m_gainDirty.fill(0, (rows + 63) / 64);
+    m_shapeDirty.fill(0, (rows + 63) / 64);
+
+    // constant-Q graphic EQ: q from the band spacing in octaves
+    const double octaves = bands == 31 ? 1.0 / 3 : bands == 10 ? 1.0 : bands > 1 ? qLn(1000.0) / qLn(2.0) / (bands - 1) : 1.0;
+    const double ratio = qPow(2.0, octaves);
+    const quint16 q = bands == 3 ? 70 : quint16(qRound(100 * qSqrt(ratio) / (ratio - 1)));
+
+    for (int b = 0; b < bands; b++)
+    {
+        quint16 freq;
+        if (bands == 31)
+            freq = isoThirdOctave[b];
+        else if (bands == 10)
+            freq = isoOctave[b];
+        else if (bands == 3)
+            freq = threeBand[b];
+        else
+            freq = quint16(qRound(20.0 * qPow(1000.0, bands > 1 ? double(b) / (bands - 1) : 0.5)));
+
+        for (int c = 0; c < channels; c++)
+        {
+            m_freq[row(c, b)] = freq;
+            m_q[row(c, b)] = q;
+        }
+    }
+
+    endResetModel();
+
+    Q_EMIT eqLayoutChanged();
+}
+
+void EqBandModel::setGain(int channel, int band, double gain)
+{
+    if (channel < 0 || channel >= m_channels || band < 0 || band >= m_bands)
+        return;
+
+    const int r = row(channel, band);
+    const qint16 value = qint16(qBound(-32768, qRound(gain * 10), 32767));
+
+    if (m_gain.at(r) == value)
+        return;
+
+    m_gain[r] = value;
+    markGain(r);
+    notifyRange(r, r, QVector<int>() << GainRole);
+}
+
+void EqBandModel::setGains(int channel, const QVariantList &gains)
+{
+    if (channel < 0 || channel >= m_channels)
+        return;
+
+    int first = -1, last = -1;
+    const int count = qMin(gains.size(), m_bands);
+
+    for (int b = 0; b < count; b++)
+    {
+        const int r = row(channel, b);
+        const qint16 value = qint16(qBound(-32768, qRound(gains.at(b).toDouble() * 10), 32767));
+
+        if (m_gain.at(r) == value)
+            continue;
+
+        m_gain[r] = value;
+        markGain(r);
+
+        if (first < 0)
+            first = r;
+        last = r;
+    }
+
+    // one notification for the whole curve
+    if (first >= 0)
+        notifyRange(first, last, QVector<int>() << GainRole);
+}
+
+void EqBandModel::setShape(int channel, int band, int frequency, double q)
+{
+    if (channel < 0 || channel >= m_channels || band < 0 || band >= m_bands)
+        return;
+
+    const int r = row(channel, band);
+    const quint16 f = quint16(qBound(1, frequency, 65535));
+    const quint16 qq = quint16(qBound(1, qRound(q * 100), 65535));
+
+    if (m_freq.at(r) == f && m_q.at(r) == qq)
+        return;
+
+    m_freq[r] = f;
+    m_q[r] = qq;
+    markShape(r);
+    notifyRange(r, r, QVector<int>() << FrequencyRole << QRole);
+}
+
+void EqBandModel::markGain(int r)
+{
+    const bool wasDirty = dirty();
+    setBit(m_gainDirty, r);
+
+    if (!wasDirty)
+        Q_EMIT dirtied();
+}
+
+void EqBandModel::markShape(int r)
+{
+    const bool wasDirty = dirty();
+    setBit(m_shapeDirty, r);
+
+    if (!wasDirty)
+        Q_EMIT dirtied();
+}
+
+void EqBandModel::notifyRange(int first, int last, const QVector<int> &roles)
+{
+    Q_EMIT dataChanged(index(first), index(last), roles);
+}
+
+int EqBandModel::firstBit(const QVector<quint64> &bits)
+{
+    for (int w = 0; w < bits.size(); w++)
+    {
+        if (bits.at(w))
+            return w * 64 + int(qCountTrailingZeroBits(bits.at(w)));
+    }
+    return -1;
+}
+
+bool EqBandModel::dirty() const
+{
+    for (int w = 0; w < m_gainDirty.size(); w++)
+    {
+        if (m_gainDirty.at(w) | m_shapeDirty.at(w))
+            return true;
+    }
+    return false;
+}
+
+
+//---------------------------------------------------//
+
+QByteArray EqBandModel::takeDirtyFrame(int maxSize)
+{
+    int r = firstBit(m_shapeDirty);
+    if (r >= 0)
+    {
+        clearBit(m_shapeDirty, r);
+
+        QByteArray frame(8, 0);
+        frame[0] = 0x04;
+        frame[1] = 0x21;
+        frame[2] = char(r / m_bands);
+        frame[3] = char(r % m_bands);
+        frame[4] = char(m_freq.at(r) >> 8);
+        frame[5] = char(m_freq.at(r));
+        frame[6] = char(m_q.at(r) >> 8);
+        frame[7] = char(m_q.at(r));
+        return frame;
+    }
+
+    r = firstBit(m_gainDirty);
+    if (r < 0)
+        return QByteArray();
+
+    const int channel = r / m_bands;
+    const int first = r % m_bands;
+    const int maxCount = qMax(1, (maxSize - HeaderSize) / 2);
+
+    // extend the run; a single clean band in between (2 bytes) is cheaper
+    // than starting another frame (5 bytes header)
+    int last = first;
+    for (int b = first + 1; b < m_bands && b - first < maxCount; b++)
+    {
+        if (testBit(m_gainDirty, row(channel, b)))
+            last = b;
+        else if (b - last >= 2)
+            break;
+    }
+
+    const int count = last - first + 1;
+
+    QByteArray frame(HeaderSize + 2 * count, 0);
+    frame[0] = 0x04;
+    frame[1] = 0x20;
+    frame[2] = char(channel);
+    frame[3] = char(first);
+    frame[4] = char(count);
+
+    for (int i = 0; i < count; i++)
+    {
+        const int rr = row(channel, first + i);
+        frame[HeaderSize + 2 * i] = char(quint16(m_gain.at(rr)) >> 8);
+        frame[HeaderSize + 2 * i + 1] = char(m_gain.at(rr));
+        clearBit(m_gainDirty, rr);
+    }
+
+    return frame;
+}
+
+void EqBandModel::applyFrame(const quint8 *data, int size)
+{
+    if (size < HeaderSize)
+        return;
+
+    const int channel = data[2];
+    const int first = data[3];
+    const int count = data[4];
+
+    if (channel >= m_channels || first + count > m_bands || size < HeaderSize + 2 * count)
+        return;
+
+    int lo = -1, hi = -1;
+
+    for (int i = 0; i < count; i++)
+    {
+        const int r = row(channel, first + i);
+
+        // local edits not yet sent win over the device report
+        if (testBit(m_gainDirty, r))
+            continue;
+
+        const qint16 value = qint16((quint16(data[HeaderSize + 2 * i]) << 8) | data[HeaderSize + 2 * i + 1]);
+        if (m_gain.at(r) == value)
+            continue;
+
+        m_gain[r] = value;
+        if (lo < 0)
+            lo = r;
+        hi = r;
+    }
+
+    if (lo >= 0)
+        notifyRange(lo, hi, QVector<int>() << GainRole);
+}
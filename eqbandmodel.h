@@ -0,0 +1,91 @@
+#ifndef EQBANDMODEL_H
+#define EQBANDMODEL_H
+
+#include <QAbstractListModel>
+#include <QVector>
+#include <QVariantList>
+
+// Graphic / parametric EQ bands for multi-band DSPs, one row per
+// channel * band. Storage is struct-of-arrays with dirty bitsets so a
+// curve drag only marks bits; BLE drains the changes as batched
+// multi-band frames at link send opportunities:
+//
+//   gains  0x04 0x20 channel first count  gain[count] (int16 BE, 0.1 dB)
+//   shape  0x04 0x21 channel band  freq (uint16 BE, Hz)  q (uint16 BE, q * 100)
+//
+// The device reports bands back with 0x04 0xA0 in the gains layout.
+// Nothing on the link announces how many bands a DSP has, so the model is
+// empty (the HM-10 tone stack firmware has none) until the UI or whoever
+// knows the device calls setLayout(); reports outside the layout are ignored.
+//
+// Gains are in dB at every QML-facing entry point, 0.1 dB on the wire.
+class EqBandModel: public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(int bands READ bands NOTIFY eqLayoutChanged)
+    Q_PROPERTY(int channels READ channels NOTIFY eqLayoutChanged)
+
+public:
+    enum Roles {
+        GainRole = Qt::UserRole + 1,
+        FrequencyRole,
+        QRole,
+        ChannelRole,
+        BandRole
+    };
+
+    enum { HeaderSize = 5, MaxBands = 64 };
+
+    explicit EqBandModel(QObject *parent = 0);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role) const;
+    bool setData(const QModelIndex &index, const QVariant &value, int role);
+    Qt::ItemFlags flags(const QModelIndex &index) const;
+    QHash<int, QByteArray> roleNames() const;
+
+    int bands() const { return m_bands; }
+    int channels() const { return m_channels; }
+
+    // 3, 10 (octave) or 31 (third octave) bands get ISO centres; 0 disables
+    Q_INVOKABLE void setLayout(int bands, int channels);
+
+    Q_INVOKABLE void setGain(int channel, int band, double gain);
+    Q_INVOKABLE void setGains(int channel, const QVariantList &gains);
+    Q_INVOKABLE void setShape(int channel, int band, int frequency, double q);
+
+    bool dirty() const;
+
+    // next outbound frame of at most maxSize bytes; clears the bits it carries
+    QByteArray takeDirtyFrame(int maxSize);
+
+    // 0x04 0xA0 report from the device; does not mark anything dirty
+    void applyFrame(const quint8 *data, int size);
+
+signals:
+    void eqLayoutChanged();
+    void dirtied();
+
+private:
+    int row(int channel, int band) const { return channel * m_bands + band; }
+    void markGain(int row);
+    void markShape(int row);
+    void notifyRange(int first, int last, const QVector<int> &roles);
+
+    static bool testBit(const QVector<quint64> &bits, int i) { return bits.at(i >> 6) & (Q_UINT64_C(1) << (i & 63)); }
+    static void setBit(QVector<quint64> &bits, int i) { bits[i >> 6] |= Q_UINT64_C(1) << (i & 63); }
+    static void clearBit(QVector<quint64> &bits, int i) { bits[i >> 6] &= ~(Q_UINT64_C(1) << (i & 63)); }
+    static int firstBit(const QVector<quint64> &bits);
+
+    int m_bands;
+    int m_channels;
+
+    QVector<qint16> m_gain;      // 0.1 dB
+    QVector<quint16> m_freq;     // Hz
+    QVector<quint16> m_q;        // q * 100
+
+    QVector<quint64> m_gainDirty;
+    QVector<quint64> m_shapeDirty;
+};
+
+#endif // EQBANDMODEL_H
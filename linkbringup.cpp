@@ -0,0 +1,71 @@
+#include "linkbringup.h"
+
+static const char *const phaseNames[LinkBringUp::PhaseCount] = {
+    "idle",
+    "connect",
+    "discover",
+    "details",
+    "notify",
+    "state",
+    "ready"
+};
+
+
+LinkBringUp::LinkBringUp():
+    m_phase(Idle)
+{
+    for (int i = 0; i < PhaseCount; i++)
+        m_at[i] = -1;
+}
+
+void LinkBringUp::start()
+{
+    for (int i = 0; i < PhaseCount; i++)
+        m_at[i] = -1;
+
+    m_clock.start();
+    m_phase = Idle;
+    m_at[Idle] = 0;
+}
+
+void LinkBringUp::reach(Phase phase)
+{
+    if (!m_clock.isValid() || phase <= m_phase)
+        return;
+
+    m_phase = phase;
+    m_at[phase] = m_clock.elapsed();
+}
+
+void LinkBringUp::abort()
+{
+    m_phase = Idle;
+    m_clock.invalidate();
+}
+
+// each figure is the time spent in the named phase
+QString LinkBringUp::breakdown() const
+{
+    QString out;
+    int prev = -1;
+
+    for (int i = Connecting; i < PhaseCount; i++)
+    {
+        if (m_at[i] < 0)
+            continue;
+
+        if (prev >= 0)
+        {
+            if (!out.isEmpty())
+                out += ", ";
+            out += QString("%1 %2 ms").arg(phaseNames[prev]).arg(m_at[i] - m_at[prev]);
+        }
+        prev = i;
+    }
+    return out;
+}
+
+const char *LinkBringUp::phaseName(Phase phase)
+{
+    return phaseNames[phase];
+}
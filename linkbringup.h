@@ -0,0 +1,50 @@
+#ifndef LINKBRINGUP_H
+#define LINKBRINGUP_H
+
+#include <QtGlobal>
+#include <QString>
+
+#include "linkclock.h"
+
+// Connection bring-up as explicit phases. BLE advances it from the
+// controller / service callbacks; each phase records when it was reached
+// (ms since start()), which gives the per-phase breakdown and the time to
+// first control. Phases a backend does not have (sockets) stay unset.
+class LinkBringUp
+{
+public:
+    enum Phase {
+        Idle,
+        Connecting,         // connectToDevice() / socket open issued
+        Discovering,        // link up, services being discovered
+        ServiceDetails,     // 0xffe0 found, its characteristics being read
+        EnablingNotify,     // CCCD write on 0xffe1 in flight
+        AwaitingState,      // notifications on, mode request sent
+        Ready,              // first state frame: controls usable
+        PhaseCount
+    };
+
+    LinkBringUp();
+
+    void start();
+    void reach(Phase phase);    // later phases only, repeats are ignored
+    void abort();
+
+    Phase phase() const { return m_phase; }
+    bool active() const { return m_phase != Idle && m_phase != Ready; }
+
+    qint64 at(Phase phase) const { return m_at[phase]; }    // -1 if not reached
+    qint64 timeToFirstControl() const { return m_at[Ready]; }
+
+    // "connect 180 ms, discover 95 ms, ..." between consecutive reached phases
+    QString breakdown() const;
+
+    static const char *phaseName(Phase phase);
+
+private:
+    LinkElapsedTimer m_clock;
+    Phase m_phase;
+    qint64 m_at[PhaseCount];
+};
+
+#endif // LINKBRINGUP_H
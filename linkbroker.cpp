@@ -0,0 +1,295 @@
+#include "linkbroker.h"
+#include "ble.h"
+#include "streamtransport.h"
+
+#include <QDebug>
+#include <QDateTime>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+#include <new>
+#include <string.h>
+
+#define BROKER_STATE_MAGIC  0x424c4542      // "BLEB"
+#define BROKER_READ_RETRIES 64
+#define BROKER_PROBE_TIMEOUT_MS 500
+
+
+LinkBroker::LinkBroker(BLE *ble, QObject *parent):
+    QObject(parent), m_ble(ble), m_server(0), m_state(0)
+{
+    connect(m_ble, SIGNAL(frameReceived(QByteArray)), this, SLOT(deviceFrame(QByteArray)));
+
+    connect(m_ble, SIGNAL(on_off_Changed()), this, SLOT(publish()));
+    connect(m_ble, SIGNAL(volume_Changed()), this, SLOT(publish()));
+    connect(m_ble, SIGNAL(bass_Changed()), this, SLOT(publish()));
+    connect(m_ble, SIGNAL(middle_Changed()), this, SLOT(publish()));
+    connect(m_ble, SIGNAL(treble_Changed()), this, SLOT(publish()));
+    connect(m_ble, SIGNAL(sound_style_Changed()), this, SLOT(publish()));
+    connect(m_ble, SIGNAL(conEnableChanged()), this, SLOT(publish()));
+    connect(m_ble, SIGNAL(serial_numChanged()), this, SLOT(publish()));
+}
+
+LinkBroker::~LinkBroker()
+{
+    if (m_state)
+    {
+        m_state->connected = 0;
+        m_state->clients = 0;
+        m_memory.detach();
+    }
+}
+
+bool LinkBroker::listen(const QString &url)
+{
+    const QString name = url.mid(url.indexOf(':') + 1);
+
+    // a broker that still answers owns the radio; only a stale socket is removed
+    QLocalSocket probe;
+    probe.connectToServer(name);
+    if (probe.waitForConnected(BROKER_PROBE_TIMEOUT_MS))
+    {
+        qWarning() << "broker: another broker already serves" << url;
+        probe.abort();
+        return false;
+    }
+
+    m_server = new QLocalServer(this);
+    connect(m_server, SIGNAL(newConnection()), this, SLOT(newConnection()));
+
+    QLocalServer::removeServer(name);
+    if (!m_server->listen(name))
+    {
+        qWarning() << "broker: cannot listen on" << url << m_server->errorString();
+        return false;
+    }
+
+    // a segment left behind by a crashed broker is reused
+    m_memory.setKey("ble-broker:" + name);
+    if (!m_memory.create(sizeof(SharedState)) && !m_memory.attach())
+    {
+        qWarning() << "broker: no shared state" << m_memory.errorString();
+        return true;
+    }
+
+    m_state = new (m_memory.data()) SharedState;
+    m_state->sequence.store(0, std::memory_order_relaxed);
+    m_state->magic = BROKER_STATE_MAGIC;
+    publish();
+
+    qDebug() << "broker: listening on" << m_server->fullServerName();
+    return true;
+}
+
+//---------------------------------------------------//
+
+void LinkBroker::newConnection()
+{
+    while (m_server->hasPendingConnections())
+    {
+        QLocalSocket *socket = m_server->nextPendingConnection();
+        connect(socket, SIGNAL(readyRead()), this, SLOT(readClient()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(clientGone()));
+
+        Client client;
+        client.viewValid = false;
+        m_clients.insert(socket, client);
+        qDebug() << "broker: client connected," << m_clients.size() << "attached";
+    }
+    publish();
+}
+
+void LinkBroker::clientGone()
+{
+    QLocalSocket *socket = qobject_cast<QLocalSocket *>(sender());
+    m_clients.remove(socket);
+    socket->deleteLater();
+    publish();
+}
+
+void LinkBroker::readClient()
+{
+    QLocalSocket *socket = qobject_cast<QLocalSocket *>(sender());
+    if (!socket || !m_clients.contains(socket))
+        return;
+
+    Client &client = m_clients[socket];
+    client.buffer += socket->readAll();
+
+    int pos = 0;
+    int length;
+
+    while ((length = StreamTransport::frameLength(client.buffer.constData() + pos, client.buffer.size() - pos)) >= 0)
+    {
+        handleClientFrame(socket, client, reinterpret_cast<const quint8 *>(client.buffer.constData()) + pos + 1, length);
+        pos += 1 + length;
+    }
+
+    client.buffer.remove(0, pos);
+}
+
+void LinkBroker::handleClientFrame(QLocalSocket *socket, Client &client, const quint8 *data, int size)
+{
+    if (size < 2)
+        return;
+
+    const quint8 type = data[0];
+    const quint8 cmd = data[1];
+    const QByteArray frame(reinterpret_cast<const char *>(data), size);
+
+    if (type == 0x01 && cmd == 0x02)
+    {
+        // mode request: the broker already holds the state
+        if (m_ble->con_enable)
+            send(socket, stateFrame(0x01));
+    }
+    else if (type == 0x02 && cmd == 0x13 && size >= ParamSchema::StateFrameSize)
+    {
+        // apply only what this client changed relative to what it last saw,
+        // so a stale full frame does not undo another client's edits
+        int values[ParamCount];
+        ParamSchema::decodeState(data, values);
+
+        const int *base = client.viewValid ? client.view : m_ble->data_params;
+        bool changed = false;
+
+        for (int i = 0; i < ParamCount; i++)
+        {
+            const int value = qBound(ParamSchema::params[i].minimum, values[i], ParamSchema::params[i].maximum);
+            if (value != base[i] && value != m_ble->data_params[i])
+            {
+                m_ble->changeParam(i, value);
+                changed = true;
+            }
+            client.view[i] = value;
+        }
+        client.viewValid = true;
+
+        // nothing goes to the device, so no echo would come back
+        if (!changed)
+            send(socket, stateFrame(0x02));
+    }
+    else if (type == 0x03 && cmd == 0x02 && size >= 3)
+    {
+        if (m_ble->current_style == data[2])
+            send(socket, stateFrame(0x03));
+        else
+            m_ble->change_sound_style(data[2]);
+    }
+    else if (!m_ble->con_enable)
+    {
+        // queries wait for the client's own retry
+    }
+    else if (type == 0xAB && cmd == 0xCD)
+    {
+        // heartbeats of every client are served without touching the radio
+        if (!m_versionFrame.isEmpty())
+            send(socket, m_versionFrame);
+        else
+            m_ble->queueFrame(OutboundScheduler::Query, frame);
+    }
+    else if (type == 0x04)
+        m_ble->queueFrame(OutboundScheduler::Interactive, frame);
+    else if (type == 0x05 && cmd == 0x01)
+        m_ble->queueFrame(OutboundScheduler::Query, frame);
+    else
+        m_ble->queueFrame(OutboundScheduler::Bulk, frame);
+}
+
+//---------------------------------------------------//
+
+void LinkBroker::deviceFrame(const QByteArray &frame)
+{
+    if (frame.size() >= 2 && quint8(frame[0]) == 0xAB && quint8(frame[1]) == 0xDC)
+        m_versionFrame = frame;
+
+    const bool state = frame.size() >= ParamSchema::StateFrameSize && quint8(frame[1]) == 0x13;
+    int values[ParamCount];
+    if (state)
+        ParamSchema::decodeState(reinterpret_cast<const quint8 *>(frame.constData()), values);
+
+    for (QHash<QLocalSocket *, Client>::iterator it = m_clients.begin(); it != m_clients.end(); ++it)
+    {
+        send(it.key(), frame);
+
+        if (state)
+        {
+            memcpy(it.value().view, values, sizeof(values));
+            it.value().viewValid = true;
+        }
+    }
+}
+
+void LinkBroker::send(QLocalSocket *socket, const QByteArray &frame)
+{
+    QByteArray out;
+    out.reserve(frame.size() + 1);
+    out += char(frame.size());
+    out += frame;
+    socket->write(out);
+}
+
+QByteArray LinkBroker::stateFrame(quint8 type) const
+{
+    QByteArray frame(ParamSchema::StateFrameSize, 0);
+    frame[0] = char(type);
+    frame[1] = 0x13;
+    ParamSchema::encodeState(m_ble->data_params, reinterpret_cast<quint8 *>(frame.data()));
+    frame[ParamSchema::StyleOffset] = char(m_ble->current_style);
+    return frame;
+}
+
+//---------------------------------------------------//
+
+void LinkBroker::publish()
+{
+    if (!m_state)
+        return;
+
+    const quint32 seq = m_state->sequence.load(std::memory_order_relaxed);
+    m_state->sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    m_state->updatedMs = QDateTime::currentMSecsSinceEpoch();
+    m_state->connected = m_ble->con_enable ? 1 : 0;
+    m_state->style = m_ble->current_style;
+    for (int i = 0; i < ParamCount; i++)
+        m_state->params[i] = m_ble->data_params[i];
+    m_state->clients = m_clients.size();
+
+    const QByteArray serial = m_ble->serial_num().toLatin1();
+    memset(m_state->serial, 0, sizeof(m_state->serial));
+    memcpy(m_state->serial, serial.constData(), qMin(serial.size(), int(sizeof(m_state->serial)) - 1));
+
+    m_state->sequence.store(seq + 2, std::memory_order_release);
+}
+
+bool LinkBroker::readState(QSharedMemory &memory, SharedState &state)
+{
+    const SharedState *shared = static_cast<const SharedState *>(memory.constData());
+    if (!shared || memory.size() < int(sizeof(SharedState)) || shared->magic != BROKER_STATE_MAGIC)
+        return false;
+
+    for (int attempt = 0; attempt < BROKER_READ_RETRIES; attempt++)
+    {
+        const quint32 before = shared->sequence.load(std::memory_order_acquire);
+        if (before & 1)
+            continue;
+
+        state.magic = shared->magic;
+        state.updatedMs = shared->updatedMs;
+        state.connected = shared->connected;
+        state.style = shared->style;
+        memcpy(state.params, shared->params, sizeof(state.params));
+        state.clients = shared->clients;
+        memcpy(state.serial, shared->serial, sizeof(state.serial));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (shared->sequence.load(std::memory_order_relaxed) == before)
+        {
+            state.sequence.store(before, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
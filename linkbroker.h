@@ -0,0 +1,87 @@
+#ifndef LINKBROKER_H
+#define LINKBROKER_H
+
+#include <QObject>
+#include <QHash>
+#include <QByteArray>
+#include <QSharedMemory>
+
+#include <atomic>
+
+#include "paramschema.h"
+
+class BLE;
+class QLocalServer;
+class QLocalSocket;
+
+// Owns the one BLE link and shares it between local processes. Clients
+// connect to a local socket and speak the StreamTransport framing, so a
+// second app instance attaches with BLE_TRANSPORT=unix:/path unchanged.
+//
+// Client writes are merged into BLE's single paced stream: settings frames
+// are diffed against what that client last saw and only the changed
+// parameters are applied, styles go through change_sound_style(), mode and
+// version queries are answered from the broker's state. Every frame the
+// device sends is relayed to all clients.
+//
+// The current state is also published in shared memory under a seqlock,
+// for readers that only poll it.
+class LinkBroker: public QObject
+{
+    Q_OBJECT
+
+public:
+    struct SharedState
+    {
+        quint32 magic;
+        std::atomic<quint32> sequence;  // odd while the broker writes
+        qint64 updatedMs;               // ms since epoch
+        qint32 connected;
+        qint32 style;
+        qint32 params[ParamCount];
+        qint32 clients;
+        char serial[16];
+    };
+
+    explicit LinkBroker(BLE *ble, QObject *parent = 0);
+    ~LinkBroker();
+
+    // unix:/path/to/socket or local:name
+    bool listen(const QString &url);
+
+    QString sharedMemoryKey() const { return m_memory.key(); }
+    int clientCount() const { return m_clients.size(); }
+
+    // consistent copy of a broker's state, memory attached by the caller
+    static bool readState(QSharedMemory &memory, SharedState &state);
+
+private slots:
+    void newConnection();
+    void readClient();
+    void clientGone();
+    void deviceFrame(const QByteArray &frame);
+    void publish();
+
+private:
+    struct Client
+    {
+        QByteArray buffer;
+        int view[ParamCount];
+        bool viewValid;
+    };
+
+    void handleClientFrame(QLocalSocket *socket, Client &client, const quint8 *data, int size);
+    void send(QLocalSocket *socket, const QByteArray &frame);
+    QByteArray stateFrame(quint8 type) const;
+
+    BLE *m_ble;
+    QLocalServer *m_server;
+    QHash<QLocalSocket *, Client> m_clients;
+
+    QSharedMemory m_memory;
+    SharedState *m_state;
+
+    QByteArray m_versionFrame;
+};
+
+#endif // LINKBROKER_H
@@ -0,0 +1,186 @@
+#include "linkclock.h"
+
+#include <QElapsedTimer>
+
+// QTimer per LinkTimer, monotonic time since first use
+class SystemClock: public LinkClock
+{
+public:
+    SystemClock() { m_clock.start(); }
+
+    qint64 now() const { return m_clock.elapsed(); }
+
+protected:
+    void arm(LinkTimer *timer, int ms)
+    {
+        timer->m_timer.setSingleShot(timer->m_singleShot);
+        timer->m_timer.start(ms);
+    }
+
+    void disarm(LinkTimer *timer)
+    {
+        timer->m_timer.stop();
+    }
+
+private:
+    QElapsedTimer m_clock;
+};
+
+static LinkClock *s_current = 0;
+
+
+LinkClock *LinkClock::current()
+{
+    static SystemClock system;
+    return s_current ? s_current : &system;
+}
+
+void LinkClock::install(LinkClock *clock)
+{
+    s_current = clock;
+}
+
+//---------------------------------------------------//
+
+VirtualClock::VirtualClock():
+    m_now(0), m_sequence(0), m_processed(0)
+{
+}
+
+VirtualClock::~VirtualClock()
+{
+    QHash<LinkTimer *, Key>::const_iterator it;
+    for (it = m_armed.constBegin(); it != m_armed.constEnd(); ++it)
+        it.key()->m_clock = 0;
+}
+
+int VirtualClock::advance(qint64 ms)
+{
+    const qint64 target = m_now + qMax<qint64>(0, ms);
+
+    int ran = 0;
+    while (!m_queue.isEmpty() && m_queue.firstKey().first <= target)
+    {
+        runFirst();
+        ran++;
+    }
+
+    m_now = target;
+    return ran;
+}
+
+bool VirtualClock::step()
+{
+    if (m_queue.isEmpty())
+        return false;
+
+    const qint64 deadline = m_queue.firstKey().first;
+    while (!m_queue.isEmpty() && m_queue.firstKey().first == deadline)
+        runFirst();
+    return true;
+}
+
+qint64 VirtualClock::nextDeadline() const
+{
+    return m_queue.isEmpty() ? -1 : m_queue.firstKey().first;
+}
+
+void VirtualClock::post(qint64 ms, const std::function<void ()> &event)
+{
+    Entry entry;
+    entry.timer = 0;
+    entry.event = event;
+    m_queue.insert(Key(m_now + qMax<qint64>(0, ms), m_sequence++), entry);
+}
+
+void VirtualClock::arm(LinkTimer *timer, int ms)
+{
+    disarm(timer);
+
+    // a zero interval repeating timer would never let the time move
+    const int delay = timer->m_singleShot ? qMax(0, ms) : qMax(1, ms);
+    const Key key(m_now + delay, m_sequence++);
+
+    Entry entry;
+    entry.timer = timer;
+    m_queue.insert(key, entry);
+    m_armed.insert(timer, key);
+}
+
+void VirtualClock::disarm(LinkTimer *timer)
+{
+    QHash<LinkTimer *, Key>::iterator it = m_armed.find(timer);
+    if (it == m_armed.end())
+        return;
+
+    m_queue.remove(it.value());
+    m_armed.erase(it);
+}
+
+void VirtualClock::runFirst()
+{
+    QMap<Key, Entry>::iterator it = m_queue.begin();
+    const qint64 deadline = it.key().first;
+    const Entry entry = it.value();
+    m_queue.erase(it);
+
+    m_now = qMax(m_now, deadline);
+    m_processed++;
+
+    if (!entry.timer)
+    {
+        entry.event();
+        return;
+    }
+
+    // repeating timers are re-armed before they run, like QTimer
+    m_armed.remove(entry.timer);
+    if (!entry.timer->m_singleShot)
+        arm(entry.timer, entry.timer->m_interval);
+
+    entry.timer->fire();
+}
+
+//---------------------------------------------------//
+
+LinkTimer::LinkTimer(QObject *parent):
+    QObject(parent), m_clock(0), m_interval(0), m_singleShot(false)
+{
+    connect(&m_timer, SIGNAL(timeout()), this, SLOT(fire()));
+}
+
+LinkTimer::~LinkTimer()
+{
+    stop();
+}
+
+void LinkTimer::start(int ms)
+{
+    stop();
+
+    m_interval = ms;
+    m_clock = LinkClock::current();
+    m_clock->arm(this, ms);
+}
+
+void LinkTimer::start()
+{
+    start(m_interval);
+}
+
+void LinkTimer::stop()
+{
+    if (!m_clock)
+        return;
+
+    m_clock->disarm(this);
+    m_clock = 0;
+}
+
+void LinkTimer::fire()
+{
+    if (m_singleShot)
+        m_clock = 0;
+
+    Q_EMIT timeout();
+}
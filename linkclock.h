@@ -0,0 +1,137 @@
+#ifndef LINKCLOCK_H
+#define LINKCLOCK_H
+
+#include <QObject>
+#include <QTimer>
+#include <QMap>
+#include <QPair>
+#include <QHash>
+
+#include <functional>
+
+class LinkTimer;
+
+// Time source of the link state machine: BLE's write / heartbeat /
+// reconnect timers, the pacer, watchdog, scheduler, request timeouts and
+// ramps all read it. The process-wide current() clock is the monotonic
+// system clock unless a simulation installs a VirtualClock, which must
+// happen before the objects using it are created.
+class LinkClock
+{
+public:
+    virtual ~LinkClock() {}
+
+    // ms, monotonic
+    virtual qint64 now() const = 0;
+
+    static LinkClock *current();
+    static void install(LinkClock *clock);  // 0 restores the system clock
+
+protected:
+    friend class LinkTimer;
+
+    virtual void arm(LinkTimer *timer, int ms) = 0;
+    virtual void disarm(LinkTimer *timer) = 0;
+};
+
+// Discrete-event clock: time only moves in advance() / step(), and due
+// timers and posted events run in deadline order, ties in the order they
+// were armed. No wall clock or event loop is involved, so a run is
+// deterministic and hours of link time take milliseconds.
+class VirtualClock: public LinkClock
+{
+public:
+    VirtualClock();
+    ~VirtualClock();
+
+    qint64 now() const { return m_now; }
+
+    // runs everything due up to now() + ms, then sets the time to that;
+    // returns the number of timers / events run
+    int advance(qint64 ms);
+    // jumps to the next deadline and runs what is due then, false if idle
+    bool step();
+
+    qint64 nextDeadline() const;    // -1 if nothing is armed
+    int pending() const { return m_queue.size(); }
+    quint64 processed() const { return m_processed; }
+
+    // one-off callback at now() + ms (simulated peers, scenarios)
+    void post(qint64 ms, const std::function<void ()> &event);
+
+protected:
+    void arm(LinkTimer *timer, int ms);
+    void disarm(LinkTimer *timer);
+
+private:
+    typedef QPair<qint64, quint64> Key;     // deadline, sequence
+
+    struct Entry
+    {
+        LinkTimer *timer;                   // 0 for posted events
+        std::function<void ()> event;
+    };
+
+    void runFirst();
+
+    qint64 m_now;
+    quint64 m_sequence;
+    quint64 m_processed;
+    QMap<Key, Entry> m_queue;
+    QHash<LinkTimer *, Key> m_armed;
+};
+
+// QTimer subset on LinkClock::current(), bound to the clock at start()
+class LinkTimer: public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LinkTimer(QObject *parent = 0);
+    ~LinkTimer();
+
+    void setSingleShot(bool singleShot) { m_singleShot = singleShot; }
+    bool isSingleShot() const { return m_singleShot; }
+
+    void setInterval(int ms) { m_interval = ms; }
+    int interval() const { return m_interval; }
+
+    bool isActive() const { return m_clock != 0; }
+
+public slots:
+    void start(int ms);
+    void start();
+    void stop();
+
+signals:
+    void timeout();
+
+private slots:
+    void fire();
+
+private:
+    friend class VirtualClock;
+    friend class SystemClock;
+
+    QTimer m_timer;         // system clock backend
+    LinkClock *m_clock;     // armed on
+    int m_interval;
+    bool m_singleShot;
+};
+
+// QElapsedTimer on LinkClock::current()
+class LinkElapsedTimer
+{
+public:
+    LinkElapsedTimer(): m_start(-1) {}
+
+    void start() { m_start = LinkClock::current()->now(); }
+    void invalidate() { m_start = -1; }
+    bool isValid() const { return m_start >= 0; }
+    qint64 elapsed() const { return LinkClock::current()->now() - m_start; }
+
+private:
+    qint64 m_start;
+};
+
+#endif // LINKCLOCK_H
@@ -0,0 +1,182 @@
+#include "linkpacer.h"
+
+#include <QtMath>
+#include <QDebug>
+
+#define MIN_RATE            5.0     // frames/s, never slower than one per 200 ms
+#define START_RATE          20.0    // the old fixed 50 ms spacing
+#define DEFAULT_INTERVAL    7.5     // ms, what deviceConnected() requests
+#define INITIAL_RTO         1000
+#define MIN_RTO             100
+#define MAX_RTO             2000
+
+
+LinkPacer::LinkPacer()
+{
+    m_connInterval = DEFAULT_INTERVAL;
+    reset();
+}
+
+void LinkPacer::reset()
+{
+    m_clock.start();
+
+    m_pendingCount = 0;
+
+    m_rate = START_RATE;
+    m_srtt = 0;
+    m_rttvar = 0;
+    m_throughput = 0;
+
+    m_lastSend = -INITIAL_RTO;
+    m_windowStart = 0;
+    m_windowBytes = 0;
+    m_losses = 0;
+}
+
+void LinkPacer::setConnectionInterval(double ms)
+{
+    if (ms <= 0)
+        return;
+
+    m_connInterval = ms;
+    m_rate = qMin(m_rate, 1000.0 / m_connInterval);
+}
+
+int LinkPacer::interval() const
+{
+    return qCeil(1000.0 / m_rate);
+}
+
+int LinkPacer::rto() const
+{
+    if (m_srtt == 0)
+        return INITIAL_RTO;
+
+    return qBound(MIN_RTO, qCeil(m_srtt + 4 * m_rttvar), MAX_RTO);
+}
+
+int LinkPacer::nextDelay()
+{
+    expire();
+
+    const qint64 now = m_clock.elapsed();
+
+    // too many unanswered requests: wait for the oldest one to resolve
+    if (m_pendingCount >= MaxPending)
+        return qMax<qint64>(m_pending[0].sentAt + rto() - now, 1);
+
+    return qMax<qint64>(m_lastSend + interval() - now, 0);
+}
+
+void LinkPacer::onSent(int bytes, quint8 replyType, quint8 replyCmd)
+{
+    expire();
+
+    m_lastSend = m_clock.elapsed();
+
+    if (!replyType && !replyCmd)
+        return;
+
+    if (m_pendingCount == MaxPending)
+    {
+        for (int i = 1; i < m_pendingCount; i++)
+            m_pending[i - 1] = m_pending[i];
+        m_pendingCount--;
+    }
+
+    Pending &p = m_pending[m_pendingCount++];
+    p.type = replyType;
+    p.cmd = replyCmd;
+    p.bytes = bytes;
+    p.sentAt = m_lastSend;
+}
+
+void LinkPacer::onReceived(quint8 type, quint8 cmd, int bytes)
+{
+    const qint64 now = m_clock.elapsed();
+
+    int i = 0;
+    while (i < m_pendingCount && (m_pending[i].type != type || m_pending[i].cmd != cmd))
+        i++;
+
+    if (i == m_pendingCount)
+        return;     // unsolicited frame, nothing to measure
+
+    const double sample = now - m_pending[i].sentAt;
+
+    // RFC 6298 smoothing
+    if (m_srtt == 0)
+    {
+        m_srtt = sample;
+        m_rttvar = sample / 2;
+    }
+    else
+    {
+        m_rttvar = 0.75 * m_rttvar + 0.25 * qAbs(m_srtt - sample);
+        m_srtt = 0.875 * m_srtt + 0.125 * sample;
+    }
+
+    m_windowBytes += m_pending[i].bytes + bytes;
+    if (now - m_windowStart >= 1000)
+    {
+        const double current = m_windowBytes * 1000.0 / (now - m_windowStart);
+        m_throughput = m_throughput == 0 ? current : 0.5 * m_throughput + 0.5 * current;
+        m_windowStart = now;
+        m_windowBytes = 0;
+    }
+
+    for (int j = i + 1; j < m_pendingCount; j++)
+        m_pending[j - 1] = m_pending[j];
+    m_pendingCount--;
+
+    // additive increase
+    m_rate = qMin(m_rate + 1.0, 1000.0 / m_connInterval);
+}
+
+void LinkPacer::expire()
+{
+    const qint64 now = m_clock.elapsed();
+    const int timeout = rto();
+
+    int kept = 0;
+    for (int i = 0; i < m_pendingCount; i++)
+    {
+        if (now - m_pending[i].sentAt < timeout)
+            m_pending[kept++] = m_pending[i];
+    }
+
+    if (kept == m_pendingCount)
+        return;
+
+    m_losses += m_pendingCount - kept;
+    m_pendingCount = kept;
+
+    // multiplicative decrease, once per expiry round
+    m_rate = qMax(m_rate / 2, MIN_RATE);
+
+    qWarning() << "link pacer: reply timeout, rate now" << m_rate << "frames/s";
+}
+
+void LinkPacer::expectedReply(const QByteArray &frame, quint8 &type, quint8 &cmd)
+{
+    type = 0;
+    cmd = 0;
+
+    if (frame.size() < 2)
+        return;
+
+    const quint8 t = frame[0];
+    const quint8 c = frame[1];
+
+    if (t == 0xAB && c == 0xCD)         // serial / fw version
+    {
+        type = 0xAB;
+        cmd = 0xDC;
+    }
+    else if (t == 0x01 || t == 0x02 || t == 0x03)   // mode, settings, style
+    {
+        type = t;
+        cmd = 0x13;
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef LINKPACER_H
+#define LINKPACER_H
+
+#include <QtGlobal>
+#include <QByteArray>
+
+#include "linkclock.h"
+
+// Estimates what the BLE link actually sustains and paces outbound frames.
+//
+// RTT is sampled from request/reply pairs (settings 0x02 -> 0x02 0x13,
+// mode 0x01 -> 0x01 0x13, style 0x03 -> 0x03 0x13, serial 0xAB 0xCD -> 0xAB 0xDC),
+// throughput from the bytes those replies acknowledge. The send rate follows
+// AIMD: +1 frame/s per acknowledged frame, halved when a reply times out,
+// bounded above by one frame per connection interval.
+class LinkPacer
+{
+public:
+    LinkPacer();
+
+    void reset();
+
+    void setConnectionInterval(double ms);
+    double connectionInterval() const { return m_connInterval; }
+
+    // ms to wait before the next frame may go out
+    int nextDelay();
+
+    // replyType/replyCmd of the frame the device answers with, 0/0 if none
+    void onSent(int bytes, quint8 replyType, quint8 replyCmd);
+    void onReceived(quint8 type, quint8 cmd, int bytes);
+
+    static void expectedReply(const QByteArray &frame, quint8 &type, quint8 &cmd);
+
+    double rate() const { return m_rate; }                  // frames/s
+    int interval() const;                                   // ms between frames
+    double srtt() const { return m_srtt; }                  // ms
+    int rto() const;                                        // ms
+    double throughput() const { return m_throughput; }      // acked bytes/s
+    int inFlight() const { return m_pendingCount; }
+    int losses() const { return m_losses; }
+
+private:
+    void expire();
+
+    struct Pending
+    {
+        quint8 type;
+        quint8 cmd;
+        int bytes;
+        qint64 sentAt;
+    };
+
+    enum { MaxPending = 4 };
+
+    LinkElapsedTimer m_clock;
+
+    Pending m_pending[MaxPending];
+    int m_pendingCount;
+
+    double m_connInterval;
+    double m_rate;
+    double m_srtt;
+    double m_rttvar;
+    double m_throughput;
+
+    qint64 m_lastSend;
+    qint64 m_windowStart;
+    qint64 m_windowBytes;
+    int m_losses;
+};
+
+#endif // LINKPACER_H
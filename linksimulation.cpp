@@ -0,0 +1,309 @@
+#include "linksimulation.h"
+#include "ble.h"
+
+#include <QElapsedTimer>
+
+#include <algorithm>
+
+#define SIM_PEER_NAME "link"
+#define SIM_URL "sim:link"
+
+// a connect attempt during an outage fails after this long
+#define SIM_CONNECT_TIMEOUT_MS 2000
+
+
+LinkSimulation::Options::Options():
+    durationMs(3600 * 1000), latencyMs(15), jitterMs(10), lossRate(0.002), controlMs(100),
+    outageEveryMs(600 * 1000), outageMs(20 * 1000), seed(1)
+{
+}
+
+LinkSimulation::LinkSimulation(QObject *parent):
+    QObject(parent), m_clock(0), m_device(0), m_ble(0), m_transport(0), m_attachments(0), m_generation(0),
+    m_random(1), m_lastToDevice(0), m_lastFromDevice(0), m_outage(false), m_outageEnded(-1),
+    m_controlPending(-1), m_controlValue(0)
+{
+}
+
+LinkSimulation::Result LinkSimulation::run(const Options &options)
+{
+    m_options = options;
+    m_result = Result();
+    m_result.digest = 2166136261u;
+
+    m_random = options.seed ? options.seed : 1;
+    m_attachments = 0;
+    m_generation = 0;
+    m_lastToDevice = 0;
+    m_lastFromDevice = 0;
+    m_outage = false;
+    m_outageEnded = -1;
+    m_controlPending = -1;
+
+    QElapsedTimer wall;
+    wall.start();
+
+    // installed before BLE exists: its timers and elapsed timers bind to it
+    VirtualClock clock;
+    m_clock = &clock;
+    LinkClock::install(&clock);
+    StreamTransport::registerPeer(SIM_PEER_NAME, this);
+
+    DeviceStandIn device;
+    m_device = &device;
+
+    {
+        BLE ble(true);
+        m_ble = &ble;
+        m_controlValue = ble.data_params[ParamVolume];
+        ble.seedBackoff(random());
+
+        connect(&ble, &BLE::conEnableChanged, this, [this]() {
+            if (m_ble->ConEnable() && m_outageEnded >= 0)
+            {
+                m_result.recoveryMs.append(int(m_clock->now() - m_outageEnded));
+                m_outageEnded = -1;
+            }
+        });
+
+        ble.connectToTransport(SIM_URL);
+        scheduleControl();
+        scheduleOutage();
+
+        while (clock.nextDeadline() >= 0 && clock.nextDeadline() <= options.durationMs)
+            clock.step();
+        clock.advance(options.durationMs - clock.now());
+
+        m_result.simulatedMs = clock.now();
+        m_result.events = clock.processed();
+        m_ble = 0;
+    }
+
+    StreamTransport::registerPeer(SIM_PEER_NAME, 0);
+    LinkClock::install(0);
+    m_device = 0;
+    m_clock = 0;
+
+    m_result.wallMs = wall.elapsed();
+    return m_result;
+}
+
+//---------------------------------------------------//
+
+void LinkSimulation::attach(StreamTransport *transport)
+{
+    m_transport = transport;
+    if (m_attachments++)
+        m_result.reconnects++;
+
+    const int generation = ++m_generation;
+
+    m_clock->post(m_outage ? SIM_CONNECT_TIMEOUT_MS : 2 * m_options.latencyMs, [this, generation]() {
+        if (generation != m_generation || !m_transport)
+            return;
+
+        if (m_outage)
+        {
+            StreamTransport *transport = m_transport;
+            m_transport = 0;
+            m_generation++;
+            transport->peerDisconnected();
+        }
+        else
+            m_transport->peerConnected();
+    });
+}
+
+void LinkSimulation::detach(StreamTransport *transport)
+{
+    if (m_transport != transport)
+        return;
+
+    m_transport = 0;
+    m_generation++;
+}
+
+void LinkSimulation::receive(StreamTransport *, const QByteArray &frame)
+{
+    m_result.framesOut++;
+    trace('>', frame);
+
+    // the change the frame carries counts from when it was first made
+    const bool settings = frame.size() >= 2 && quint8(frame.at(0)) == 0x02 && quint8(frame.at(1)) == 0x13;
+    const qint64 changedAt = settings ? m_controlPending : -1;
+    if (settings)
+        m_controlPending = -1;
+
+    if (m_outage || lost())
+    {
+        m_result.framesLost++;
+        if (changedAt >= 0 && m_controlPending < 0)
+            m_controlPending = changedAt;
+        return;
+    }
+
+    const int generation = m_generation;
+
+    m_clock->post(deliveryDelay(m_lastToDevice), [this, frame, settings, changedAt, generation]() {
+        if (settings)
+        {
+            m_result.settingsFrames++;
+            if (changedAt >= 0)
+                m_result.controlLatency.append(int(m_clock->now() - changedAt));
+        }
+        if (quint8(frame.at(0)) == 0xAB)
+            m_result.pings++;
+
+        QList<QByteArray> replies;
+        m_device->handleFrame(reinterpret_cast<const quint8 *>(frame.constData()), frame.size(), replies);
+
+        for (int i = 0; i < replies.size(); i++)
+        {
+            if (m_outage || lost())
+            {
+                m_result.framesLost++;
+                continue;
+            }
+
+            const QByteArray reply = replies.at(i);
+            m_clock->post(deliveryDelay(m_lastFromDevice), [this, reply, generation]() {
+                if (generation != m_generation || !m_transport)
+                    return;
+
+                m_result.framesIn++;
+                trace('<', reply);
+                m_transport->peerFrame(reply);
+            });
+        }
+    });
+}
+
+//---------------------------------------------------//
+
+void LinkSimulation::scheduleControl()
+{
+    if (m_options.controlMs <= 0)
+        return;
+
+    m_clock->post(m_options.controlMs, [this]() {
+        // a different volume every time, 10..89
+        int value = 10 + int(random() % 80);
+        if (value == m_controlValue)
+            value = value == 89 ? 10 : value + 1;
+        m_controlValue = value;
+
+        m_result.controls++;
+        if (m_controlPending < 0)
+            m_controlPending = m_clock->now();
+
+        m_ble->changeParam(ParamVolume, value);
+        scheduleControl();
+    });
+}
+
+void LinkSimulation::scheduleOutage()
+{
+    if (m_options.outageEveryMs <= 0 || m_options.outageMs <= 0)
+        return;
+
+    m_clock->post(m_options.outageEveryMs, [this]() {
+        m_outage = true;
+        m_outageEnded = -1;
+        m_result.outages++;
+
+        m_clock->post(m_options.outageMs, [this]() {
+            m_outage = false;
+            m_outageEnded = m_clock->now();
+        });
+
+        scheduleOutage();
+    });
+}
+
+// seeded LCG; with the reconnect jitter, seeded from it, the only randomness in a run
+quint32 LinkSimulation::random()
+{
+    m_random = m_random * 1664525u + 1013904223u;
+    return m_random >> 8;
+}
+
+bool LinkSimulation::lost()
+{
+    return m_options.lossRate > 0 && random() < quint32(m_options.lossRate * (1u << 24));
+}
+
+// latency plus jitter, never overtaking the previous frame in that direction
+qint64 LinkSimulation::deliveryDelay(qint64 &lastDelivery)
+{
+    const int jitter = m_options.jitterMs > 0 ? int(random() % quint32(m_options.jitterMs + 1)) : 0;
+    const qint64 at = qMax(lastDelivery, m_clock->now() + m_options.latencyMs + jitter);
+    lastDelivery = at;
+    return at - m_clock->now();
+}
+
+void LinkSimulation::trace(char direction, const QByteArray &frame)
+{
+    quint32 h = m_result.digest;
+    const qint64 now = m_clock->now();
+
+    for (int i = 0; i < 8; i++)
+        h = (h ^ quint8(now >> (8 * i))) * 16777619u;
+    h = (h ^ quint8(direction)) * 16777619u;
+    for (int i = 0; i < frame.size(); i++)
+        h = (h ^ quint8(frame.at(i))) * 16777619u;
+
+    m_result.digest = h;
+}
+
+//---------------------------------------------------//
+
+static int percentile(QVector<int> values, int p)
+{
+    if (values.isEmpty())
+        return 0;
+
+    std::sort(values.begin(), values.end());
+    return values.at((values.size() - 1) * p / 100);
+}
+
+static double average(const QVector<int> &values)
+{
+    if (values.isEmpty())
+        return 0;
+
+    qint64 sum = 0;
+    for (int i = 0; i < values.size(); i++)
+        sum += values.at(i);
+    return double(sum) / values.size();
+}
+
+QByteArray LinkSimulation::report(const Result &r)
+{
+    QByteArray out;
+    char line[160];
+
+    qsnprintf(line, sizeof(line), "simulated %.1f s in %lld ms (%.0fx real time), %llu timers/events\n",
+              r.simulatedMs / 1000.0, (long long)r.wallMs, double(r.simulatedMs) / qMax<qint64>(1, r.wallMs),
+              (unsigned long long)r.events);
+    out += line;
+
+    qsnprintf(line, sizeof(line), "controls %d, settings frames at the device %d\n", r.controls, r.settingsFrames);
+    out += line;
+
+    qsnprintf(line, sizeof(line), "control latency ms: avg %.1f p50 %d p99 %d max %d\n",
+              average(r.controlLatency), percentile(r.controlLatency, 50), percentile(r.controlLatency, 99),
+              percentile(r.controlLatency, 100));
+    out += line;
+
+    qsnprintf(line, sizeof(line), "frames out %d, in %d, lost %d, pings %d\n", r.framesOut, r.framesIn, r.framesLost, r.pings);
+    out += line;
+
+    qsnprintf(line, sizeof(line), "outages %d, reconnect attempts %d, recovery after outage ms: avg %.0f max %d\n",
+              r.outages, r.reconnects, average(r.recoveryMs), percentile(r.recoveryMs, 100));
+    out += line;
+
+    qsnprintf(line, sizeof(line), "trace digest %08x\n", r.digest);
+    out += line;
+
+    return out;
+}
@@ -0,0 +1,102 @@
+#ifndef LINKSIMULATION_H
+#define LINKSIMULATION_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QVector>
+
+#include "linkclock.h"
+#include "streamtransport.h"
+#include "devicestandin.h"
+
+class BLE;
+
+// Deterministic run of the BLE state machine in virtual time. A managed BLE
+// talks over sim:link to an in-process DeviceStandIn with seeded latency,
+// jitter, frame loss and silent link outages, while a simulated user moves
+// the volume. Write pacing, heartbeats, request timeouts, reconnect backoff
+// and the state restore all run on a VirtualClock, so an hour of link time
+// takes well under a second and the same seed gives the same trace digest.
+class LinkSimulation: public QObject, public TransportPeer
+{
+    Q_OBJECT
+
+public:
+    struct Options
+    {
+        Options();
+
+        qint64 durationMs;
+        int latencyMs;          // one way
+        int jitterMs;
+        double lossRate;        // each frame, both directions
+        int controlMs;          // interval between user changes, 0 none
+        int outageEveryMs;      // 0 no outages
+        int outageMs;
+        quint32 seed;
+    };
+
+    struct Result
+    {
+        qint64 simulatedMs;
+        qint64 wallMs;
+        quint64 events;         // timers and posted events run
+
+        int controls;           // user changes
+        int settingsFrames;     // 0x02 frames that reached the device
+        QVector<int> controlLatency;    // change to first settings frame at the device, ms
+
+        int framesOut;
+        int framesIn;
+        int framesLost;
+        int pings;
+
+        int outages;
+        int reconnects;         // attach attempts after the first
+        QVector<int> recoveryMs;
+
+        quint32 digest;         // FNV-1a over the timed frame trace
+    };
+
+    explicit LinkSimulation(QObject *parent = 0);
+
+    Result run(const Options &options);
+
+    static QByteArray report(const Result &result);
+
+    // TransportPeer
+    void attach(StreamTransport *transport);
+    void detach(StreamTransport *transport);
+    void receive(StreamTransport *transport, const QByteArray &frame);
+
+private:
+    quint32 random();
+    bool lost();
+    qint64 deliveryDelay(qint64 &lastDelivery);
+    void trace(char direction, const QByteArray &frame);
+
+    void scheduleControl();
+    void scheduleOutage();
+
+    Options m_options;
+    Result m_result;
+
+    VirtualClock *m_clock;
+    DeviceStandIn *m_device;
+    BLE *m_ble;
+
+    StreamTransport *m_transport;
+    int m_attachments;
+    int m_generation;           // bumped on attach / detach, drops stale deliveries
+
+    quint32 m_random;
+    qint64 m_lastToDevice;
+    qint64 m_lastFromDevice;
+    bool m_outage;
+    qint64 m_outageEnded;       // -1 once the link is back
+
+    qint64 m_controlPending;    // first unsent change, -1 if none
+    int m_controlValue;
+};
+
+#endif // LINKSIMULATION_H
@@ -0,0 +1,91 @@
+#include "linkwatchdog.h"
+
+#include <QDateTime>
+
+#define BACKOFF_BASE_MS     250
+#define BACKOFF_MAX_MS      30000
+
+
+LinkWatchdog::LinkWatchdog():
+    m_interval(1000), m_maxMisses(3), m_lastInbound(0), m_pingSentAt(0),
+    m_pingOutstanding(false), m_misses(0), m_rtt(-1), m_recovering(false), m_attempts(0),
+    m_random(quint32(QDateTime::currentMSecsSinceEpoch()) ^ quint32(quintptr(this)))
+{
+    m_clock.start();
+}
+
+void LinkWatchdog::linkUp()
+{
+    m_lastInbound = m_clock.elapsed();
+    m_pingOutstanding = false;
+    m_misses = 0;
+}
+
+LinkWatchdog::Action LinkWatchdog::tick()
+{
+    const qint64 now = m_clock.elapsed();
+
+    if (m_pingOutstanding)
+    {
+        if (++m_misses >= m_maxMisses)
+            return Dead;
+    }
+    else if (now - m_lastInbound < m_interval)
+    {
+        // regular traffic already proves the link, no ping needed
+        return Idle;
+    }
+
+    return SendPing;
+}
+
+void LinkWatchdog::onPingSent()
+{
+    if (!m_pingOutstanding)
+        m_pingSentAt = m_clock.elapsed();
+
+    m_pingOutstanding = true;
+}
+
+void LinkWatchdog::onInbound(bool isPong)
+{
+    m_lastInbound = m_clock.elapsed();
+
+    if (isPong && m_pingOutstanding)
+        m_rtt = int(m_lastInbound - m_pingSentAt);
+
+    m_pingOutstanding = false;
+    m_misses = 0;
+}
+
+void LinkWatchdog::linkLost()
+{
+    if (!m_recovering)
+        m_recovery.start();
+
+    m_recovering = true;
+    m_attempts = 0;
+    m_pingOutstanding = false;
+}
+
+int LinkWatchdog::nextBackoff()
+{
+    const int shift = qMin(m_attempts, 16);
+    const int delay = qMin(BACKOFF_BASE_MS << shift, BACKOFF_MAX_MS);
+    m_attempts++;
+
+    // +-25 % jitter so several clients do not retry in lockstep
+    const int jitter = delay / 4;
+    m_random = m_random * 1664525u + 1013904223u;
+    return delay - jitter + int((m_random >> 8) % quint32(2 * jitter + 1));
+}
+
+qint64 LinkWatchdog::recovered()
+{
+    if (!m_recovering)
+        return -1;
+
+    m_recovering = false;
+    m_attempts = 0;
+    return m_recovery.elapsed();
+}
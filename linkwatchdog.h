@@ -0,0 +1,67 @@
+#ifndef LINKWATCHDOG_H
+#define LINKWATCHDOG_H
+
+#include <QtGlobal>
+
+#include "linkclock.h"
+
+// Heartbeat bookkeeping for the BLE link. BLE calls tick() from
+// connetion_check_timer; when nothing was received during an interval a
+// ping is requested, and after maxMisses unanswered intervals the link is
+// declared dead. Also provides the reconnect backoff and measures how long
+// recovery took.
+class LinkWatchdog
+{
+public:
+    enum Action {
+        Idle,
+        SendPing,
+        Dead
+    };
+
+    LinkWatchdog();
+
+    void setInterval(int ms) { m_interval = qMax(100, ms); }
+    int interval() const { return m_interval; }
+
+    void setMaxMisses(int misses) { m_maxMisses = qMax(1, misses); }
+    int maxMisses() const { return m_maxMisses; }
+
+    void linkUp();
+    Action tick();
+
+    void onPingSent();
+    void onInbound(bool isPong);
+
+    int rtt() const { return m_rtt; }
+    int misses() const { return m_misses; }
+
+    // reconnect handling
+    void linkLost();
+    bool recovering() const { return m_recovering; }
+    int nextBackoff();
+    int attempts() const { return m_attempts; }
+    qint64 recovered();     // ms since linkLost(), ends the recovery
+
+    // backoff jitter, seeded per instance unless a run needs it repeatable
+    void setSeed(quint32 seed) { m_random = seed; }
+
+private:
+    LinkElapsedTimer m_clock;
+    LinkElapsedTimer m_recovery;
+
+    int m_interval;
+    int m_maxMisses;
+
+    qint64 m_lastInbound;
+    qint64 m_pingSentAt;
+    bool m_pingOutstanding;
+    int m_misses;
+    int m_rtt;
+
+    bool m_recovering;
+    int m_attempts;
+    quint32 m_random;
+};
+
+#endif // LINKWATCHDOG_H
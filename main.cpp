@@ -10,23 +10,390 @@
 #include <QQmlContext>
 #include <QGuiApplication>
 #include <QQuickView>
+#include <QtQml>
+#include <QCommandLineParser>
+#include <QTextStream>
+#include <QStandardPaths>
+#include <QFile>
 #include "ble.h"
+#include "dspengine.h"
+#include "roomanalyzer.h"
+#include "blemetrics.h"
+#include "devicestandin.h"
+#include "linkbroker.h"
+#include "batchprovisioner.h"
+#include "renderprofiler.h"
+#include "paramslider.h"
+#include "alloctracker.h"
+#include "linksimulation.h"
+
+
+// Offline reference DSP: render WAV files, benchmark the biquad chain and
+// suggest a tone stack from a room measurement without a device, e.g.
+//   BLEInterface --dsp-render in.wav out.wav --volume 80 --bass 2400
+//   BLEInterface --dsp-bench 60
+//   BLEInterface --dsp-room sweep.wav --target house.txt
+static int runDspTool(const QCoreApplication &app)
+{
+    QCommandLineParser parser;
+    parser.addHelpOption();
+
+    QCommandLineOption renderOpt("dsp-render", "Process <in> WAV into <out> WAV (positional arguments).");
+    QCommandLineOption benchOpt("dsp-bench", "Benchmark the chain over <seconds> of audio.", "seconds", "60");
+    QCommandLineOption roomOpt("dsp-room", "Suggest bass/middle/treble from a room measurement WAV "
+                               "recorded with the given values.", "wav");
+    QCommandLineOption targetOpt("target", "Target curve for --dsp-room, one '<Hz> <dB>' pair per line.", "file");
+    QCommandLineOption whiteOpt("white", "The --dsp-room stimulus is white noise or a linear sweep.");
+    QCommandLineOption rateOpt("rate", "Benchmark sample rate.", "hz", "48000");
+    QCommandLineOption channelsOpt("channels", "Benchmark channel count.", "n", "2");
+    QCommandLineOption onOffOpt("on-off", "data_on_off value.", "value", "1");
+    QCommandLineOption volumeOpt("volume", "data_volume value (0..100).", "value", "100");
+    QCommandLineOption bassOpt("bass", "data_bass value (0..4000).", "value", "2000");
+    QCommandLineOption middleOpt("middle", "data_middle value (0..100).", "value", "50");
+    QCommandLineOption trebleOpt("treble", "data_treble value (0..4000).", "value", "2000");
+
+    parser.addOptions(QList<QCommandLineOption>() << renderOpt << benchOpt << roomOpt << targetOpt << whiteOpt
+                      << rateOpt << channelsOpt << onOffOpt << volumeOpt << bassOpt << middleOpt << trebleOpt);
+    parser.addPositionalArgument("files", "Input and output WAV for --dsp-render.", "[in.wav out.wav]");
+    parser.process(app);
+
+    DspParams params;
+    params.on_off = parser.value(onOffOpt).toInt();
+    params.volume = parser.value(volumeOpt).toInt();
+    params.bass = parser.value(bassOpt).toInt();
+    params.middle = parser.value(middleOpt).toInt();
+    params.treble = parser.value(trebleOpt).toInt();
+
+    DspEngine engine(parser.value(rateOpt).toDouble(), parser.value(channelsOpt).toInt());
+    engine.setParams(params);
+
+    QTextStream out(stdout);
+
+    if (parser.isSet(renderOpt))
+    {
+        const QStringList files = parser.positionalArguments();
+        if (files.size() != 2)
+        {
+            out << "--dsp-render needs <in.wav> <out.wav>" << "\n";
+            return 1;
+        }
+
+        QString error;
+        if (!engine.processWav(files.at(0), files.at(1), &error))
+        {
+            out << "DSP render failed: " << error << "\n";
+            return 1;
+        }
+
+        out << "Rendered " << files.at(1) << "\n";
+        return 0;
+    }
+
+    if (parser.isSet(roomOpt))
+    {
+        RoomAnalyzer analyzer;
+        QString error;
+
+        if (parser.isSet(whiteOpt))
+            analyzer.setStimulus(RoomAnalyzer::White);
+        if (parser.isSet(targetOpt) && !analyzer.loadTarget(parser.value(targetOpt), &error))
+        {
+            out << "Cannot load target: " << error << "\n";
+            return 1;
+        }
+        if (!analyzer.analyseWav(parser.value(roomOpt), &error))
+        {
+            out << "Room analysis failed: " << error << "\n";
+            return 1;
+        }
+
+        const RoomCorrection c = analyzer.suggest(params);
+
+        out << "     Hz  measured  target  corrected" << "\n";
+        for (int b = 0; b < c.bandHz.size(); b++)
+            out << QString::asprintf("%7.0f %9.1f %7.1f %10.1f", c.bandHz.at(b), c.measuredDb.at(b),
+                                     c.targetDb.at(b), c.correctedDb.at(b)) << "\n";
+
+        out << "suggested: --bass " << c.params.bass << " --middle " << c.params.middle
+            << " --treble " << c.params.treble << "\n";
+        out << QString::asprintf("deviation %.2f dB -> %.2f dB rms, analysis %.1f ms",
+                                 c.rmsBeforeDb, c.rmsAfterDb, c.analysisMs) << "\n";
+        return 0;
+    }
+
+    const double rate = engine.benchmark(parser.value(benchOpt).toDouble());
+    const double realtime = engine.sampleRate() * engine.channels();
+
+    out << "samples/sec: " << qRound64(rate) << " (" << rate / realtime << "x real time)" << "\n";
+    return 0;
+}
+
+
+// Connects, configures and verifies every unit of the manifest, then writes
+// the per-unit JSON report and prints the summary with devices/hour.
+static int runProvisioning(QCoreApplication &app, const QString &manifest, const QString &reportPath)
+{
+    QTextStream out(stdout);
+
+    BatchProvisioner batch;
+    QString error;
+    if (!batch.loadManifest(manifest, &error))
+    {
+        out << "Cannot load manifest " << manifest << ": " << error << "\n";
+        return 1;
+    }
+
+    QObject::connect(&batch, &BatchProvisioner::finished, &app, [&app](int failed) {
+        app.exit(failed ? 2 : 0);
+    });
+
+    batch.start();
+    const int ret = app.exec();
+
+    if (!reportPath.isEmpty())
+    {
+        QFile file(reportPath);
+        if (file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            file.write(batch.report());
+        else
+            out << "Cannot write report " << reportPath << ": " << file.errorString() << "\n";
+    }
+
+    out << batch.summary();
+    return ret;
+}
+
+
+// Steady-state allocation check: drives control changes, scan callbacks and
+// the device echo against an in-process stand-in and counts the heap
+// allocations per event (qmake CONFIG+=alloc_tracking). Exit code 1 if any
+// steady-state event allocated, 2 if tracking is not built in.
+#define ALLOC_CHECK_TICK_MS 16
+#define ALLOC_CHECK_WARMUP 64
+#define ALLOC_CHECK_DRAIN_MS 500
+
+static int runAllocCheck(QCoreApplication &app, int events)
+{
+    QTextStream out(stdout);
+
+    if (!AllocTracker::available())
+    {
+        out << AllocTracker::report();
+        return 2;
+    }
+
+    const QString url = QStringLiteral("local:ble-alloc-check");
+    DeviceStandIn standIn;
+    if (!standIn.listen(url))
+        return 1;
+
+    BLE ble(true);
+
+    // built once, every tick replays the same advert with a moving RSSI
+    QBluetoothDeviceInfo advert(QBluetoothAddress(QStringLiteral("00:11:22:33:44:55")),
+                                QStringLiteral("alloc-check"), 0);
+    advert.setCoreConfigurations(QBluetoothDeviceInfo::LowEnergyCoreConfiguration);
+
+    QTimer ticker;
+    ticker.setInterval(ALLOC_CHECK_TICK_MS);
+    int tick = 0;
+
+    QObject::connect(&ticker, &QTimer::timeout, &app, [&]() {
+        if (tick == ALLOC_CHECK_WARMUP)
+            AllocTracker::reset();
+
+        if (tick == ALLOC_CHECK_WARMUP + events)
+        {
+            ticker.stop();
+            QTimer::singleShot(ALLOC_CHECK_DRAIN_MS, &app, SLOT(quit()));
+            return;
+        }
+
+        ble.changeParam(ParamVolume, 20 + tick % 60);
+        advert.setRssi(qint16(-40 - tick % 30));
+        QMetaObject::invokeMethod(&ble, "addDevice", Qt::DirectConnection,
+                                  Q_ARG(QBluetoothDeviceInfo, advert));
+        tick++;
+    });
+
+    QObject::connect(&ble, &BLE::conEnableChanged, &app, [&]() {
+        if (ble.ConEnable() && !ticker.isActive() && tick == 0)
+            ticker.start();
+    });
+
+    ble.connectToTransport(url);
+    app.exec();
+
+    out << AllocTracker::report();
+
+    quint64 allocations = 0;
+    for (int p = 0; p < AllocTracker::PathCount; p++)
+        allocations += AllocTracker::allocations(AllocTracker::Path(p));
+
+    if (tick < ALLOC_CHECK_WARMUP + events || !AllocTracker::events(AllocTracker::Inbound))
+    {
+        out << "alloc check did not complete (" << tick << " ticks)" << "\n";
+        return 1;
+    }
+
+    out << (allocations ? "FAIL" : "OK") << ": " << allocations << " steady-state allocations" << "\n";
+    return allocations ? 1 : 0;
+}
+
+
+// Virtual-time run of the link state machine against a simulated device,
+// e.g. a day with an outage every 10 minutes:
+//   BLEInterface --simulate 86400 --outage-every 600 --outage 20 --repeat
+static int runSimulation(const QCoreApplication &app)
+{
+    QCommandLineParser parser;
+    parser.addHelpOption();
+
+    const LinkSimulation::Options defaults;
+
+    QCommandLineOption durationOpt("simulate", "Simulated link time.", "seconds", QString::number(defaults.durationMs / 1000));
+    QCommandLineOption seedOpt("seed", "Random seed.", "n", QString::number(defaults.seed));
+    QCommandLineOption latencyOpt("latency", "One-way frame latency.", "ms", QString::number(defaults.latencyMs));
+    QCommandLineOption jitterOpt("jitter", "Added random latency.", "ms", QString::number(defaults.jitterMs));
+    QCommandLineOption lossOpt("loss", "Frame loss rate.", "rate", QString::number(defaults.lossRate));
+    QCommandLineOption controlOpt("control-ms", "Interval between user changes, 0 none.", "ms", QString::number(defaults.controlMs));
+    QCommandLineOption outageEveryOpt("outage-every", "Link outage period, 0 none.", "seconds", QString::number(defaults.outageEveryMs / 1000));
+    QCommandLineOption outageOpt("outage", "Link outage length.", "seconds", QString::number(defaults.outageMs / 1000));
+    QCommandLineOption repeatOpt("repeat", "Run twice and fail if the traces differ.");
+
+    parser.addOptions(QList<QCommandLineOption>() << durationOpt << seedOpt << latencyOpt << jitterOpt << lossOpt
+                      << controlOpt << outageEveryOpt << outageOpt << repeatOpt);
+    parser.process(app);
+
+    LinkSimulation::Options options;
+    options.durationMs = qint64(parser.value(durationOpt).toDouble() * 1000);
+    options.seed = parser.value(seedOpt).toUInt();
+    options.latencyMs = parser.value(latencyOpt).toInt();
+    options.jitterMs = parser.value(jitterOpt).toInt();
+    options.lossRate = parser.value(lossOpt).toDouble();
+    options.controlMs = parser.value(controlOpt).toInt();
+    options.outageEveryMs = qRound(parser.value(outageEveryOpt).toDouble() * 1000);
+    options.outageMs = qRound(parser.value(outageOpt).toDouble() * 1000);
+
+    QTextStream out(stdout);
+
+    LinkSimulation simulation;
+    const LinkSimulation::Result result = simulation.run(options);
+    out << LinkSimulation::report(result);
+
+    if (parser.isSet(repeatOpt))
+    {
+        const LinkSimulation::Result again = simulation.run(options);
+        if (again.digest != result.digest)
+        {
+            out << "NOT DETERMINISTIC: second run digest " << QString::number(again.digest, 16) << "\n";
+            return 1;
+        }
+        out << "second run identical" << "\n";
+    }
+    return 0;
+}
 
 
 int main(int argc, char *argv[])
 {
     qputenv("QML_DISABLE_DISK_CACHE", "1");
 
+    if (argc > 1 && QByteArray(argv[1]).startsWith("--dsp-"))
+    {
+        QCoreApplication app(argc, argv);
+        return runDspTool(app);
+    }
+
+    // local device stand-in: BLEInterface --standin tcp://127.0.0.1:7000
+    if (argc > 2 && QByteArray(argv[1]) == "--standin")
+    {
+        QCoreApplication app(argc, argv);
+        DeviceStandIn standIn;
+        if (!standIn.listen(QString::fromLocal8Bit(argv[2])))
+            return 1;
+        return app.exec();
+    }
+
+    // headless link owner shared by local clients: BLEInterface --broker unix:/tmp/ble.sock,
+    // then BLE_TRANSPORT=unix:/tmp/ble.sock for every app instance
+    if (argc > 2 && QByteArray(argv[1]) == "--broker")
+    {
+        QCoreApplication app(argc, argv);
+        BLE ble;
+        LinkBroker broker(&ble);
+        if (!broker.listen(QString::fromLocal8Bit(argv[2])))
+            return 1;
+        return app.exec();
+    }
+
+    // factory / installation rollout: BLEInterface --provision manifest.json [report.json]
+    if (argc > 2 && QByteArray(argv[1]) == "--provision")
+    {
+        QCoreApplication app(argc, argv);
+        return runProvisioning(app, QString::fromLocal8Bit(argv[2]),
+                               argc > 3 ? QString::fromLocal8Bit(argv[3]) : QString());
+    }
+
+    if (argc > 1 && QByteArray(argv[1]) == "--simulate")
+    {
+        QCoreApplication app(argc, argv);
+        return runSimulation(app);
+    }
+
+    // BLEInterface --alloc-check [events]
+    if (argc > 1 && QByteArray(argv[1]) == "--alloc-check")
+    {
+        QCoreApplication app(argc, argv);
+        return runAllocCheck(app, argc > 2 ? qMax(QByteArray(argv[2]).toInt(), 1) : 1000);
+    }
+
     QGuiApplication app(argc, argv);
 
-    BLE ble;
+    // broker clients share the broker's data directory, it keeps the files
+    const QString transport = QString::fromLocal8Bit(qgetenv("BLE_TRANSPORT"));
+    BLE ble(false, !transport.startsWith("unix:") && !transport.startsWith("local:"));
+
+    // BLE_METRICS=127.0.0.1:9464 or BLE_METRICS=/tmp/ble-metrics.sock
+    MetricsServer *metrics = 0;
+    if (qEnvironmentVariableIsSet("BLE_METRICS"))
+        metrics = MetricsServer::start(QString::fromLocal8Bit(qgetenv("BLE_METRICS")));
+
+    qmlRegisterType<ParamSlider>("BLEInterface", 1, 0, "ParamSlider");
 
     QQuickView *view = new QQuickView;
     view->rootContext()->setContextProperty("ble", &ble);
+
+    // BLE_PROFILE=/sdcard/render-profile.txt (empty: app data dir) records
+    // frame / sync / render times and binding evaluations per BLE signal
+    RenderProfiler *profiler = 0;
+    if (qEnvironmentVariableIsSet("BLE_PROFILE"))
+    {
+        QString path = QString::fromLocal8Bit(qgetenv("BLE_PROFILE"));
+        if (path.isEmpty())
+            path = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/render-profile.txt";
+
+        profiler = new RenderProfiler(path);
+        profiler->watchSignals(&ble);
+        profiler->attach(view);
+    }
+
+    // BLE_TRANSPORT=tcp://192.168.4.1:7000 talks to a Wi-Fi DSP or stand-in instead of BLE
+    if (!transport.isEmpty())
+        ble.connectToTransport(transport);
     view->setSource(QUrl("qrc:/Start.qml"));
     view->setResizeMode(QQuickView::SizeRootObjectToView);
     //view->showMaximized();
     view->show();
-    return app.exec();
+
+    const int ret = app.exec();
+    MetricsServer::stop(metrics);
+
+    if (profiler)
+    {
+        view->hide();       // stops the render thread emitting into the profiler
+        delete profiler;
+    }
+    return ret;
 
 }
@@ -0,0 +1,175 @@
+#include "outboundscheduler.h"
+
+#include <string.h>
+
+// starvation bounds of the lower classes
+#define QUERY_MAX_WAIT_MS 200
+#define BULK_MAX_WAIT_MS 1000
+
+// initial slots per class and bytes reserved per slot (frames are < 32 bytes)
+#define INITIAL_SLOTS 8
+#define SLOT_BYTES 32
+
+
+OutboundScheduler::OutboundScheduler():
+    m_lastPromoted(false), m_promoted(0)
+{
+    m_clock.start();
+
+    m_maxWait[Interactive] = 0;
+    m_maxWait[Query] = QUERY_MAX_WAIT_MS;
+    m_maxWait[Bulk] = BULK_MAX_WAIT_MS;
+
+    for (int p = 0; p < PriorityCount; p++)
+    {
+        m_served[p] = 0;
+        m_head[p] = 0;
+        m_count[p] = 0;
+        grow(p);
+    }
+}
+
+void OutboundScheduler::clear()
+{
+    // slots and their buffers are kept
+    for (int p = 0; p < PriorityCount; p++)
+    {
+        m_head[p] = 0;
+        m_count[p] = 0;
+    }
+    m_lastPromoted = false;
+}
+
+// doubles a ring, queued entries move to the front in order
+void OutboundScheduler::grow(int priority)
+{
+    QVector<Entry> &slots = m_slots[priority];
+    const int oldSize = slots.size();
+
+    QVector<Entry> grown(qMax(INITIAL_SLOTS, oldSize * 2));
+    for (int i = 0; i < oldSize; i++)
+        grown[i] = slots.at((m_head[priority] + i) % oldSize);
+    for (int i = oldSize; i < grown.size(); i++)
+    {
+        grown[i].frame.reserve(SLOT_BYTES);     // reserved: resize() never frees it
+        grown[i].key = 0;
+        grown[i].queuedAt = 0;
+    }
+
+    slots.swap(grown);
+    m_head[priority] = 0;
+}
+
+// reuses the slot buffer while nobody else holds it
+static void copyFrame(QByteArray &slot, const QByteArray &frame)
+{
+    slot.resize(frame.size());
+    memcpy(slot.data(), frame.constData(), frame.size());
+}
+
+void OutboundScheduler::enqueue(Priority priority, const QByteArray &frame, int key)
+{
+    QVector<Entry> &slots = m_slots[priority];
+
+    if (key)
+    {
+        for (int i = 0; i < m_count[priority]; i++)
+        {
+            Entry &entry = slots[(m_head[priority] + i) % slots.size()];
+            if (entry.key == key)
+            {
+                copyFrame(entry.frame, frame);
+                return;
+            }
+        }
+    }
+
+    if (m_count[priority] == slots.size())
+        grow(priority);
+
+    Entry &entry = slots[(m_head[priority] + m_count[priority]) % slots.size()];
+    copyFrame(entry.frame, frame);
+    entry.key = key;
+    entry.queuedAt = m_clock.elapsed();
+    m_count[priority]++;
+}
+
+bool OutboundScheduler::isEmpty() const
+{
+    for (int p = 0; p < PriorityCount; p++)
+        if (m_count[p])
+            return false;
+    return true;
+}
+
+int OutboundScheduler::size() const
+{
+    int n = 0;
+    for (int p = 0; p < PriorityCount; p++)
+        n += m_count[p];
+    return n;
+}
+
+// highest lower class whose head waited too long while something
+// above it was queued, -1 if none
+int OutboundScheduler::overdue() const
+{
+    if (m_lastPromoted)
+        return -1;
+
+    const qint64 now = m_clock.elapsed();
+    bool higherWaiting = m_count[Interactive] > 0;
+
+    for (int p = Query; p < PriorityCount; p++)
+    {
+        if (!m_count[p])
+            continue;
+
+        if (higherWaiting && now - head(p).queuedAt >= m_maxWait[p])
+            return p;
+        higherWaiting = true;
+    }
+    return -1;
+}
+
+int OutboundScheduler::next() const
+{
+    const int promoted = overdue();
+    if (promoted >= 0)
+        return promoted;
+
+    for (int p = 0; p < PriorityCount; p++)
+        if (m_count[p])
+            return p;
+    return -1;
+}
+
+QByteArray OutboundScheduler::peek() const
+{
+    const int p = next();
+    return p < 0 ? QByteArray() : head(p).frame;
+}
+
+QByteArray OutboundScheduler::take(Priority *priority)
+{
+    const int promoted = overdue();
+    const int p = promoted >= 0 ? promoted : next();
+
+    m_lastPromoted = promoted >= 0;
+
+    if (p < 0)
+        return QByteArray();
+
+    if (priority)
+        *priority = Priority(p);
+
+    m_served[p]++;
+    if (m_lastPromoted)
+        m_promoted++;
+
+    const int slot = m_head[p];
+    m_head[p] = (slot + 1) % m_slots[p].size();
+    m_count[p]--;
+
+    return m_slots[p].at(slot).frame;
+}
@@ -0,0 +1,76 @@
+#ifndef OUTBOUNDSCHEDULER_H
+#define OUTBOUNDSCHEDULER_H
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QVector>
+
+#include "linkclock.h"
+
+// Outbound frame queues by priority class. take() serves strictly by
+// priority, except that a lower class whose head has waited past its
+// max wait is served once; promotions never happen twice in a row, so
+// interactive frames are delayed by at most one slot however long the
+// bulk backlog is.
+//
+// Each class is a ring of slots that keep their frame buffers: enqueue()
+// copies the bytes in, so once the rings have grown to the working depth
+// queueing does not allocate. take() hands out the slot's buffer, which
+// stays valid until that slot is reused.
+class OutboundScheduler
+{
+public:
+    enum Priority {
+        Interactive,    // user controls: settings, style, EQ
+        Query,          // state / version requests
+        Bulk,           // transfers nobody is waiting on
+        PriorityCount
+    };
+
+    OutboundScheduler();
+
+    void clear();
+
+    // key != 0 replaces a queued frame with the same key in place,
+    // so it keeps its position and age
+    void enqueue(Priority priority, const QByteArray &frame, int key = 0);
+
+    bool isEmpty() const;
+    int size() const;
+    int depth(Priority priority) const { return m_count[priority]; }
+
+    // class take() serves next, -1 when empty
+    int next() const;
+    QByteArray peek() const;
+    QByteArray take(Priority *priority = 0);
+
+    void setMaxWait(Priority priority, int ms) { m_maxWait[priority] = ms; }
+    int maxWait(Priority priority) const { return m_maxWait[priority]; }
+
+    quint64 served(Priority priority) const { return m_served[priority]; }
+    quint64 promoted() const { return m_promoted; }
+
+private:
+    struct Entry
+    {
+        QByteArray frame;
+        int key;
+        qint64 queuedAt;
+    };
+
+    int overdue() const;
+    const Entry &head(int priority) const { return m_slots[priority].at(m_head[priority]); }
+    void grow(int priority);
+
+    LinkElapsedTimer m_clock;
+    QVector<Entry> m_slots[PriorityCount];
+    int m_head[PriorityCount];
+    int m_count[PriorityCount];
+    int m_maxWait[PriorityCount];
+
+    bool m_lastPromoted;
+    quint64 m_served[PriorityCount];
+    quint64 m_promoted;
+};
+
+#endif // OUTBOUNDSCHEDULER_H
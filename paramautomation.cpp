@@ -0,0 +1,68 @@
+#include "paramautomation.h"
+
+#include <QtMath>
+
+// steepness of the exponential curve
+#define EXP_K   4.0
+
+
+ParamAutomation::ParamAutomation():
+    m_activeMask(0)
+{
+    m_clock.start();
+}
+
+void ParamAutomation::start(int param, int from, int to, int durationMs, Curve curve)
+{
+    if (param < 0 || param >= ParamCount)
+        return;
+
+    Ramp &r = m_ramps[param];
+    r.from = from;
+    r.to = to;
+    r.startedAt = m_clock.elapsed();
+    r.duration = qMax(durationMs, 0);
+    r.curve = curve;
+
+    m_activeMask |= 1u << param;
+}
+
+void ParamAutomation::cancel(int param)
+{
+    if (param >= 0 && param < ParamCount)
+        m_activeMask &= ~(1u << param);
+}
+
+void ParamAutomation::cancelAll()
+{
+    m_activeMask = 0;
+}
+
+int ParamAutomation::valueAt(int param)
+{
+    const Ramp &r = m_ramps[param];
+    const qint64 elapsed = m_clock.elapsed() - r.startedAt;
+
+    if (elapsed >= r.duration)
+    {
+        m_activeMask &= ~(1u << param);
+        return r.to;
+    }
+
+    const double t = shape(r.curve, double(elapsed) / r.duration);
+    return qRound(r.from + (r.to - r.from) * t);
+}
+
+double ParamAutomation::shape(Curve curve, double t)
+{
+    switch (curve) {
+    case Exponential:
+        // slow start, fast finish; sounds even for volume fades
+        return (qExp(EXP_K * t) - 1.0) / (qExp(EXP_K) - 1.0);
+    case SCurve:
+        return t * t * (3.0 - 2.0 * t);
+    case Linear:
+    default:
+        return t;
+    }
+}
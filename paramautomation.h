@@ -0,0 +1,53 @@
+#ifndef PARAMAUTOMATION_H
+#define PARAMAUTOMATION_H
+
+#include <QtGlobal>
+
+#include "linkclock.h"
+#include "paramschema.h"
+
+// Timed parameter ramps (fades). The engine has no timer of its own: BLE
+// samples it once per link send opportunity in writeDelay(), so every frame
+// carries the freshest intermediate value and the write path is never
+// flooded faster than the link drains.
+class ParamAutomation
+{
+public:
+    enum Curve {
+        Linear,
+        Exponential,
+        SCurve
+    };
+
+    ParamAutomation();
+
+    // a new ramp on a parameter that is already moving starts from `from`
+    // (the value last sent) and replaces the old one
+    void start(int param, int from, int to, int durationMs, Curve curve);
+    void cancel(int param);
+    void cancelAll();
+
+    bool active() const { return m_activeMask != 0; }
+    bool active(int param) const { return m_activeMask & (1u << param); }
+
+    // current value of a running ramp; finished ramps deactivate themselves
+    int valueAt(int param);
+
+private:
+    struct Ramp
+    {
+        int from;
+        int to;
+        qint64 startedAt;
+        int duration;
+        Curve curve;
+    };
+
+    static double shape(Curve curve, double t);
+
+    LinkElapsedTimer m_clock;
+    Ramp m_ramps[ParamCount];
+    quint32 m_activeMask;
+};
+
+#endif // PARAMAUTOMATION_H
@@ -0,0 +1,36 @@
+#include "paramschema.h"
+
+constexpr ParamSpec ParamSchema::params[ParamCount];
+constexpr MessageSpec ParamSchema::messages[ParamSchema::MessageSpecCount];
+
+// no two rows may share a type byte (pairs i < j)
+static constexpr bool uniqueTypes(int i, int j)
+{
+    return i >= ParamSchema::MessageSpecCount - 1 ? true
+         : j >= ParamSchema::MessageSpecCount ? uniqueTypes(i + 1, i + 2)
+         : ParamSchema::messages[i].type != ParamSchema::messages[j].type && uniqueTypes(i, j + 1);
+}
+
+static_assert(uniqueTypes(0, 1), "dispatch table is indexed by type: one reply cmd per message type");
+
+static const MessageSpec *const *buildDispatchTable()
+{
+    static const MessageSpec *table[256] = { 0 };
+
+    for (int i = 0; i < ParamSchema::MessageSpecCount; i++)
+        table[ParamSchema::messages[i].type] = &ParamSchema::messages[i];
+
+    return table;
+}
+
+const MessageSpec *const *const ParamSchema::dispatchTable = buildDispatchTable();
+
+int ParamSchema::paramByName(const QString &name)
+{
+    for (int i = 0; i < ParamCount; i++)
+    {
+        if (name == QLatin1String(params[i].name))
+            return i;
+    }
+    return -1;
+}
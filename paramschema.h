@@ -0,0 +1,118 @@
+#ifndef PARAMSCHEMA_H
+#define PARAMSCHEMA_H
+
+#include <QtGlobal>
+#include <QString>
+
+// DSP parameters, in state frame order
+enum DspParam {
+    ParamOnOff,
+    ParamVolume,
+    ParamBass,
+    ParamMiddle,
+    ParamTreble,
+    ParamCount
+};
+
+// Inbound message kinds, index into the BLE handler table
+enum DspMessage {
+    MsgState,       // 0x01/0x02/0x03 0x13: on_off, volume, bass, middle, treble, style
+    MsgVersion,     // 0xAB 0xDC: firmware version * 10
+    MsgEqBands,     // 0x04 0xA0: channel, first band, count, gains
+    MsgConfigCrc,   // 0x05 0x81: crc32 of the style table, style count
+    MsgConfigRecord,// 0x06 0x82: one style of the configuration dump
+    MsgCount
+};
+
+struct ParamSpec
+{
+    const char *name;
+    int offset;     // first byte in the 0x13 state frame
+    int width;      // 1 or 2 bytes, big endian
+    int minimum;
+    int maximum;
+};
+
+struct MessageSpec
+{
+    quint8 type;
+    quint8 cmd;
+    int minSize;
+    DspMessage message;
+};
+
+// Single description of every DSP parameter and protocol message. Frame
+// encoding, decoding, name lookup and inbound dispatch are all derived
+// from these tables; adding a parameter means adding one row.
+struct ParamSchema
+{
+    enum {
+        StateFrameSize = 12,
+        StyleOffset = 11,
+        MessageSpecCount = 7
+    };
+
+    static constexpr ParamSpec params[ParamCount] = {
+        { "on_off", 2, 1, 0, 1 },
+        { "volume", 3, 2, 0, 100 },
+        { "bass",   5, 2, 0, 4000 },     // slider value * 40
+        { "middle", 7, 2, 0, 100 },
+        { "treble", 9, 2, 0, 4000 }      // slider value * 40
+    };
+
+    static constexpr MessageSpec messages[MessageSpecCount] = {
+        { 0x01, 0x13, StateFrameSize, MsgState },
+        { 0x02, 0x13, StateFrameSize, MsgState },
+        { 0x03, 0x13, StateFrameSize, MsgState },
+        { 0xAB, 0xDC, 4, MsgVersion },
+        { 0x04, 0xA0, 5, MsgEqBands },
+        { 0x05, 0x81, 7, MsgConfigCrc },
+        { 0x06, 0x82, StateFrameSize + 1, MsgConfigRecord }
+    };
+
+    static inline int decode(const quint8 *frame, const ParamSpec &spec)
+    {
+        return spec.width == 2 ? (int(frame[spec.offset]) << 8) | frame[spec.offset + 1]
+                               : int(frame[spec.offset]);
+    }
+
+    static inline void encode(quint8 *frame, const ParamSpec &spec, int value)
+    {
+        if (spec.width == 2)
+        {
+            frame[spec.offset] = quint8(value >> 8);
+            frame[spec.offset + 1] = quint8(value);
+        }
+        else
+            frame[spec.offset] = quint8(value);
+    }
+
+    static inline void encodeState(const int *values, quint8 *frame)
+    {
+        for (int i = 0; i < ParamCount; i++)
+            encode(frame, params[i], values[i]);
+    }
+
+    static inline void decodeState(const quint8 *frame, int *values)
+    {
+        for (int i = 0; i < ParamCount; i++)
+            values[i] = decode(frame, params[i]);
+    }
+
+    // message for type/cmd in one table lookup, -1 if unknown or too short
+    static inline int dispatch(quint8 type, quint8 cmd, int size)
+    {
+        const MessageSpec *spec = dispatchTable[type];
+        if (!spec || spec->cmd != cmd || size < spec->minSize)
+            return -1;
+        return spec->message;
+    }
+
+    static int paramByName(const QString &name);
+
+private:
+    // indexed by type byte; each type carries a single reply cmd
+    static const MessageSpec *const *const dispatchTable;
+};
+
+#endif // PARAMSCHEMA_H
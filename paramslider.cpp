@@ -0,0 +1,355 @@
+#include "paramslider.h"
+
+#include <QDebug>
+#include <QMouseEvent>
+#include <QQuickWindow>
+#include <QSGGeometryNode>
+#include <QSGFlatColorMaterial>
+#include <QtMath>
+
+// arc vertices per rounded corner
+#define CORNER_SEGMENTS 6
+
+#define TRACK_COLOR "#3A3A3A"
+#define KNOB_COLOR "#A9A9A9"
+#define DISABLED_OPACITY 0.4
+
+
+ParamSlider::ParamSlider(QQuickItem *parent):
+    QQuickItem(parent), m_minimum(0), m_maximum(100), m_value(50), m_accent("#FF9800"),
+    m_pressed(false), m_grabOffset(0), m_pending(false), m_forwarded(0),
+    m_externalPending(false), m_external(0), m_factor(1)
+{
+    setFlag(ItemHasContents, true);
+    setAcceptedMouseButtons(Qt::LeftButton);
+}
+
+void ParamSlider::setMinimum(int minimum)
+{
+    if (m_minimum == minimum)
+        return;
+    m_minimum = minimum;
+    emit rangeChanged();
+    update();
+}
+
+void ParamSlider::setMaximum(int maximum)
+{
+    if (m_maximum == maximum)
+        return;
+    m_maximum = maximum;
+    emit rangeChanged();
+    update();
+}
+
+void ParamSlider::setValue(int value)
+{
+    if (m_pressed)
+    {
+        m_external = value;
+        m_externalPending = true;
+        return;
+    }
+
+    if (m_value == value)
+        return;
+    m_value = value;
+    emit valueChanged();
+    update();
+}
+
+void ParamSlider::setAccent(const QColor &accent)
+{
+    if (m_accent == accent)
+        return;
+    m_accent = accent;
+    emit accentChanged();
+    update();
+}
+
+void ParamSlider::setTarget(QObject *target)
+{
+    if (m_target == target)
+        return;
+    m_target = target;
+    resolveTarget();
+    emit targetChanged();
+}
+
+void ParamSlider::setTargetProperty(const QString &name)
+{
+    if (m_propertyName == name)
+        return;
+    m_propertyName = name;
+    resolveTarget();
+    emit targetChanged();
+}
+
+void ParamSlider::setFactor(int factor)
+{
+    if (m_factor == factor)
+        return;
+    m_factor = factor;
+    emit targetChanged();
+}
+
+// looked up once, writes go through the cached QMetaProperty
+void ParamSlider::resolveTarget()
+{
+    m_property = QMetaProperty();
+    if (!m_target || m_propertyName.isEmpty())
+        return;
+
+    const int index = m_target->metaObject()->indexOfProperty(m_propertyName.toLatin1().constData());
+    if (index < 0)
+    {
+        qWarning() << "ParamSlider: no property" << m_propertyName << "on" << m_target;
+        return;
+    }
+    m_property = m_target->metaObject()->property(index);
+}
+
+//---------------------------------------------------//
+
+qreal ParamSlider::valueToX(int value) const
+{
+    if (m_maximum == m_minimum)
+        return 0;
+    return qBound(qreal(0), qreal(value - m_minimum) / (m_maximum - m_minimum) * travel(), travel());
+}
+
+int ParamSlider::xToValue(qreal x) const
+{
+    if (travel() <= 0)
+        return m_minimum;
+    const int value = m_minimum + qRound(x / travel() * (m_maximum - m_minimum));
+    return qBound(qMin(m_minimum, m_maximum), value, qMax(m_minimum, m_maximum));
+}
+
+void ParamSlider::mousePressEvent(QMouseEvent *event)
+{
+    // the knob's vertical extent around the track is the touch target
+    const qreal centre = trackY() + trackHeight() / 2;
+    if (qAbs(event->localPos().y() - centre) > knobHeight())
+    {
+        event->ignore();
+        return;
+    }
+
+    const qreal knobX = valueToX(m_value);
+    const qreal x = event->localPos().x();
+
+    setPressed(true);
+    setKeepMouseGrab(true);
+
+    // grabbing the knob keeps its offset, a tap on the track centres it there
+    if (x >= knobX && x <= knobX + knobWidth())
+        m_grabOffset = x - knobX;
+    else
+    {
+        m_grabOffset = knobWidth() / 2;
+        dragTo(x - m_grabOffset);
+    }
+
+    event->accept();
+}
+
+void ParamSlider::mouseMoveEvent(QMouseEvent *event)
+{
+    if (m_pressed)
+        dragTo(event->localPos().x() - m_grabOffset);
+}
+
+void ParamSlider::mouseReleaseEvent(QMouseEvent *event)
+{
+    if (m_pressed)
+        dragTo(event->localPos().x() - m_grabOffset);
+    release();
+}
+
+void ParamSlider::mouseUngrabEvent()
+{
+    release();
+}
+
+void ParamSlider::dragTo(qreal x)
+{
+    const int value = xToValue(qBound(qreal(0), x, travel()));
+    if (value == m_value)
+        return;
+
+    m_value = value;
+    m_pending = true;
+    emit valueChanged();
+    update();
+}
+
+void ParamSlider::setPressed(bool pressed)
+{
+    if (m_pressed == pressed)
+        return;
+    m_pressed = pressed;
+
+    if (pressed)
+    {
+        m_forwarded = m_value;
+        m_externalPending = false;
+        if (window())
+            m_frameConnection = connect(window(), &QQuickWindow::afterAnimating, this, &ParamSlider::frame);
+    }
+    else
+        disconnect(m_frameConnection);
+
+    emit pressedChanged();
+}
+
+void ParamSlider::release()
+{
+    if (!m_pressed)
+        return;
+
+    setPressed(false);
+    setKeepMouseGrab(false);
+
+    m_pending = false;
+
+    // the target changed under the finger: the knob's value has to reach
+    // it even if it is the one last forwarded
+    if (m_externalPending && m_external != m_value)
+        m_forwarded = m_external;
+    m_externalPending = false;
+
+    forward();
+}
+
+// GUI thread, once per frame while the knob is held
+void ParamSlider::frame()
+{
+    if (!m_pending)
+        return;
+    m_pending = false;
+    forward();
+}
+
+void ParamSlider::forward()
+{
+    if (m_value == m_forwarded)
+        return;
+    m_forwarded = m_value;
+
+    if (m_target && m_property.isValid())
+        m_property.write(m_target, m_value * m_factor);
+
+    emit valueChangedByUser(m_value);
+}
+
+//---------------------------------------------------//
+
+void ParamSlider::geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry)
+{
+    QQuickItem::geometryChanged(newGeometry, oldGeometry);
+    update();
+}
+
+void ParamSlider::itemChange(ItemChange change, const ItemChangeData &data)
+{
+    if (change == ItemEnabledHasChanged)
+        update();
+    else if (change == ItemSceneChange)
+        release();
+
+    QQuickItem::itemChange(change, data);
+}
+
+// Rounded rectangle as a triangle fan around its centre
+static void setRoundedRect(QSGGeometry *geometry, const QRectF &rect, qreal radius)
+{
+    radius = qMax(qreal(0), qMin(radius, qMin(rect.width(), rect.height()) / 2));
+    const int perCorner = radius > 0 ? CORNER_SEGMENTS + 1 : 1;
+
+    if (geometry->vertexCount() != 2 + 4 * perCorner)
+        geometry->allocate(2 + 4 * perCorner);
+
+    QSGGeometry::Point2D *v = geometry->vertexDataAsPoint2D();
+    v[0].set(rect.center().x(), rect.center().y());
+
+    // corner arc centres: bottom right, bottom left, top left, top right
+    const QPointF centres[4] = {
+        QPointF(rect.right() - radius, rect.bottom() - radius),
+        QPointF(rect.left() + radius, rect.bottom() - radius),
+        QPointF(rect.left() + radius, rect.top() + radius),
+        QPointF(rect.right() - radius, rect.top() + radius)
+    };
+
+    int n = 1;
+    for (int c = 0; c < 4; c++)
+        for (int s = 0; s < perCorner; s++)
+        {
+            const qreal t = perCorner > 1 ? qreal(s) / (perCorner - 1) : qreal(0);
+            const qreal angle = (c + t) * M_PI / 2;
+            v[n++].set(centres[c].x() + radius * qCos(angle), centres[c].y() + radius * qSin(angle));
+        }
+    v[n] = v[1];
+
+    geometry->markVertexDataDirty();
+}
+
+static QSGGeometryNode *shapeNode()
+{
+    QSGGeometryNode *node = new QSGGeometryNode;
+
+    QSGGeometry *geometry = new QSGGeometry(QSGGeometry::defaultAttributes_Point2D(), 0);
+    geometry->setDrawingMode(QSGGeometry::DrawTriangleFan);
+    geometry->setVertexDataPattern(QSGGeometry::DynamicPattern);
+    node->setGeometry(geometry);
+    node->setFlag(QSGNode::OwnsGeometry);
+
+    node->setMaterial(new QSGFlatColorMaterial);
+    node->setFlag(QSGNode::OwnsMaterial);
+    return node;
+}
+
+static void setShape(QSGNode *node, const QRectF &rect, qreal radius, QColor color)
+{
+    QSGGeometryNode *shape = static_cast<QSGGeometryNode *>(node);
+    setRoundedRect(shape->geometry(), rect, radius);
+
+    QSGFlatColorMaterial *material = static_cast<QSGFlatColorMaterial *>(shape->material());
+    if (material->color() != color)
+    {
+        material->setColor(color);
+        shape->markDirty(QSGNode::DirtyMaterial);
+    }
+    shape->markDirty(QSGNode::DirtyGeometry);
+}
+
+// Render thread, GUI blocked: track, progress and knob as three fans
+QSGNode *ParamSlider::updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *)
+{
+    QSGNode *root = oldNode;
+    if (!root)
+    {
+        root = new QSGNode;
+        root->appendChildNode(shapeNode());
+        root->appendChildNode(shapeNode());
+        root->appendChildNode(shapeNode());
+    }
+
+    const qreal opacity = isEnabled() ? 1.0 : DISABLED_OPACITY;
+    const qreal knobX = valueToX(m_value);
+
+    QColor track(TRACK_COLOR), progress(m_accent), knob(KNOB_COLOR);
+    track.setAlphaF(track.alphaF() * opacity);
+    progress.setAlphaF(progress.alphaF() * opacity);
+    knob.setAlphaF(knob.alphaF() * opacity);
+
+    const QRectF trackRect(0, trackY(), width(), trackHeight());
+    const QRectF progressRect(0, trackY(), knobX + knobWidth() / 2, trackHeight());
+    const QRectF knobRect(knobX, trackY() + trackHeight() / 2 - knobHeight() / 2, knobWidth(), knobHeight());
+
+    setShape(root->childAtIndex(0), trackRect, trackHeight() / 2, track);
+    setShape(root->childAtIndex(1), progressRect, trackHeight() / 2, progress);
+    setShape(root->childAtIndex(2), knobRect, 3, knob);
+
+    return root;
+}
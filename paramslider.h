@@ -0,0 +1,117 @@
+#ifndef PARAMSLIDER_H
+#define PARAMSLIDER_H
+
+#include <QQuickItem>
+#include <QColor>
+#include <QMetaProperty>
+#include <QPointer>
+
+// Track, progress bar and knob of Slider4, drawn in the scene graph with
+// the drag and value mapping done in C++. Dragging only stores the value
+// and schedules a frame; the target property (e.g. ble.data_volume) is
+// written at most once per frame from afterAnimating(), and once more with
+// the final value on release.
+//
+// Layout matches the former QML: knob width / 20 x 2 * that, track one
+// fifth of the knob height at 1.2 knob heights from the top.
+class ParamSlider: public QQuickItem
+{
+    Q_OBJECT
+    Q_PROPERTY(int minimum READ minimum WRITE setMinimum NOTIFY rangeChanged)
+    Q_PROPERTY(int maximum READ maximum WRITE setMaximum NOTIFY rangeChanged)
+    Q_PROPERTY(int value READ value WRITE setValue NOTIFY valueChanged)
+    Q_PROPERTY(QColor accent READ accent WRITE setAccent NOTIFY accentChanged)
+    Q_PROPERTY(bool pressed READ isPressed NOTIFY pressedChanged)
+
+    // value * factor is written to target.targetProperty
+    Q_PROPERTY(QObject* target READ target WRITE setTarget NOTIFY targetChanged)
+    Q_PROPERTY(QString targetProperty READ targetProperty WRITE setTargetProperty NOTIFY targetChanged)
+    Q_PROPERTY(int factor READ factor WRITE setFactor NOTIFY targetChanged)
+
+public:
+    explicit ParamSlider(QQuickItem *parent = 0);
+
+    int minimum() const { return m_minimum; }
+    void setMinimum(int minimum);
+    int maximum() const { return m_maximum; }
+    void setMaximum(int maximum);
+
+    int value() const { return m_value; }
+    // held back while the knob is held, the device echo must not fight the
+    // finger; release() re-sends if the target moved away meanwhile
+    void setValue(int value);
+
+    QColor accent() const { return m_accent; }
+    void setAccent(const QColor &accent);
+
+    bool isPressed() const { return m_pressed; }
+
+    QObject *target() const { return m_target; }
+    void setTarget(QObject *target);
+    QString targetProperty() const { return m_propertyName; }
+    void setTargetProperty(const QString &name);
+    int factor() const { return m_factor; }
+    void setFactor(int factor);
+
+signals:
+    void rangeChanged();
+    void valueChanged();
+    void accentChanged();
+    void pressedChanged();
+    void targetChanged();
+
+    // rate limited like the target writes
+    void valueChangedByUser(int v);
+
+protected:
+    void mousePressEvent(QMouseEvent *event);
+    void mouseMoveEvent(QMouseEvent *event);
+    void mouseReleaseEvent(QMouseEvent *event);
+    void mouseUngrabEvent();
+
+    void geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry);
+    void itemChange(ItemChange change, const ItemChangeData &data);
+    QSGNode *updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *);
+
+private slots:
+    void frame();
+
+private:
+    qreal knobWidth() const { return width() / 20; }
+    qreal knobHeight() const { return knobWidth() * 2; }
+    qreal trackHeight() const { return knobHeight() / 5; }
+    qreal trackY() const { return knobHeight() * 1.2; }
+    qreal travel() const { return width() - knobWidth(); }
+
+    qreal valueToX(int value) const;
+    int xToValue(qreal x) const;
+
+    void dragTo(qreal x);
+    void release();
+    void setPressed(bool pressed);
+    void forward();
+    void resolveTarget();
+
+    int m_minimum;
+    int m_maximum;
+    int m_value;
+    QColor m_accent;
+
+    bool m_pressed;
+    qreal m_grabOffset;     // finger to knob left edge
+
+    bool m_pending;         // dragged since the last forwarded frame
+    int m_forwarded;
+
+    bool m_externalPending; // setValue() during the drag
+    int m_external;
+
+    QPointer<QObject> m_target;
+    QString m_propertyName;
+    QMetaProperty m_property;
+    int m_factor;
+
+    QMetaObject::Connection m_frameConnection;
+};
+
+#endif // PARAMSLIDER_H
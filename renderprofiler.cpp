@@ -0,0 +1,254 @@
+#include "renderprofiler.h"
+#include "ble.h"
+
+#include <QQuickWindow>
+#include <QMetaMethod>
+#include <QSaveFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDebug>
+
+#include <algorithm>
+
+// report rewrite period
+#define PROFILE_REPORT_MS 10000
+
+// a frame later than this counts as jank (1.5 x 60 Hz)
+#define PROFILE_JANK_US 25000
+
+// no frame for this long means the scene was idle, not slow
+#define PROFILE_IDLE_US 250000
+
+
+RenderProfiler::Histogram::Histogram():
+    count(0), sumUs(0), maxUs(0)
+{
+    for (int i = 0; i < Buckets; i++)
+        buckets[i].store(0, std::memory_order_relaxed);
+}
+
+void RenderProfiler::Histogram::add(qint64 us)
+{
+    const int bucket = int(qMin<qint64>(us / BucketUs, Buckets - 1));
+
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sumUs.fetch_add(quint64(us), std::memory_order_relaxed);
+
+    if (us > maxUs.load(std::memory_order_relaxed))
+        maxUs.store(us, std::memory_order_relaxed);
+}
+
+qint64 RenderProfiler::Histogram::percentile(double p) const
+{
+    const quint64 total = count.load(std::memory_order_relaxed);
+    if (!total)
+        return 0;
+
+    const quint64 rank = quint64(p * total + 0.5);
+    quint64 seen = 0;
+
+    for (int i = 0; i < Buckets - 1; i++)
+    {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+            return qint64(i + 1) * BucketUs;
+    }
+    return maxUs.load(std::memory_order_relaxed);
+}
+
+void RenderProfiler::Histogram::print(QByteArray &out, const char *name) const
+{
+    const quint64 total = count.load(std::memory_order_relaxed);
+    const double avg = total ? double(sumUs.load(std::memory_order_relaxed)) / total / 1000.0 : 0.0;
+
+    out += QByteArray(name) + ": n=" + QByteArray::number(total)
+         + " avg=" + QByteArray::number(avg, 'f', 2)
+         + " p50=" + QByteArray::number(percentile(0.50) / 1000.0, 'f', 1)
+         + " p90=" + QByteArray::number(percentile(0.90) / 1000.0, 'f', 1)
+         + " p99=" + QByteArray::number(percentile(0.99) / 1000.0, 'f', 1)
+         + " max=" + QByteArray::number(maxUs.load(std::memory_order_relaxed) / 1000.0, 'f', 1)
+         + " ms\n";
+
+    for (int i = 0; i < Buckets; i++)
+    {
+        const quint32 n = buckets[i].load(std::memory_order_relaxed);
+        if (!n)
+            continue;
+
+        out += "  ";
+        out += i < Buckets - 1 ? QByteArray::number(i * BucketUs / 1000.0, 'f', 1).rightJustified(5) + " ms "
+                               : QByteArray(">=") + QByteArray::number(i * BucketUs / 1000) + " ms ";
+        out += QByteArray::number(n).rightJustified(8) + "\n";
+    }
+}
+
+//---------------------------------------------------//
+
+RenderProfiler::RenderProfiler(const QString &reportPath, QObject *parent):
+    QObject(parent), m_path(reportPath), m_syncStart(0), m_renderStart(0), m_lastSwap(-1),
+    m_janks(0), m_idleGaps(0), m_ble(0)
+{
+    m_clock.start();
+
+    connect(&m_reportTimer, SIGNAL(timeout()), this, SLOT(writeReport()));
+    m_reportTimer.start(PROFILE_REPORT_MS);
+
+    qWarning() << "Render profiling enabled, report:" << m_path;
+}
+
+RenderProfiler::~RenderProfiler()
+{
+    writeReport();
+}
+
+void RenderProfiler::attach(QQuickWindow *window)
+{
+    // emitted on the scene graph render thread with the threaded loop
+    connect(window, SIGNAL(beforeSynchronizing()), this, SLOT(beforeSync()), Qt::DirectConnection);
+    connect(window, SIGNAL(afterSynchronizing()), this, SLOT(afterSync()), Qt::DirectConnection);
+    connect(window, SIGNAL(beforeRendering()), this, SLOT(beforeRender()), Qt::DirectConnection);
+    connect(window, SIGNAL(afterRendering()), this, SLOT(afterRender()), Qt::DirectConnection);
+    connect(window, SIGNAL(frameSwapped()), this, SLOT(frameSwapped()), Qt::DirectConnection);
+}
+
+void RenderProfiler::watchSignals(BLE *ble)
+{
+    m_ble = ble;
+
+    const QMetaObject *meta = ble->metaObject();
+    const QMetaMethod counter = metaObject()->method(metaObject()->indexOfSlot("countSignal()"));
+
+    for (int i = QObject::staticMetaObject.methodCount(); i < meta->methodCount(); i++)
+    {
+        const QMetaMethod method = meta->method(i);
+        if (method.methodType() != QMetaMethod::Signal)
+            continue;
+
+        SignalStat stat;
+        stat.name = method.name();
+        stat.signature = method.methodSignature();
+        stat.emits = 0;
+        stat.evaluations = 0;
+
+        m_signalRow.insert(method.methodIndex(), m_signals.size());
+        m_signals.append(stat);
+
+        connect(ble, method, this, counter);
+    }
+}
+
+//---------------------------------------------------//
+
+void RenderProfiler::beforeSync()
+{
+    m_syncStart = m_clock.nsecsElapsed() / 1000;
+}
+
+void RenderProfiler::afterSync()
+{
+    m_sync.add(m_clock.nsecsElapsed() / 1000 - m_syncStart);
+}
+
+void RenderProfiler::beforeRender()
+{
+    m_renderStart = m_clock.nsecsElapsed() / 1000;
+}
+
+void RenderProfiler::afterRender()
+{
+    m_render.add(m_clock.nsecsElapsed() / 1000 - m_renderStart);
+}
+
+void RenderProfiler::frameSwapped()
+{
+    const qint64 now = m_clock.nsecsElapsed() / 1000;
+
+    if (m_lastSwap >= 0)
+    {
+        const qint64 interval = now - m_lastSwap;
+
+        if (interval >= PROFILE_IDLE_US)
+            m_idleGaps.fetch_add(1, std::memory_order_relaxed);
+        else
+        {
+            m_frame.add(interval);
+            if (interval > PROFILE_JANK_US)
+                m_janks.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    m_lastSwap = now;
+}
+
+// GUI thread, runs before the QML side of the emission
+void RenderProfiler::countSignal()
+{
+    const int row = m_signalRow.value(senderSignalIndex(), -1);
+    if (row < 0 || !m_ble)
+        return;
+
+    SignalStat &stat = m_signals[row];
+    stat.emits++;
+
+    // receivers() includes QML bindings and handlers; minus this connection
+    stat.evaluations += qMax(0, m_ble->signalReceivers(stat.signature) - 1);
+}
+
+//---------------------------------------------------//
+
+QByteArray RenderProfiler::report() const
+{
+    const double seconds = m_clock.elapsed() / 1000.0;
+    const quint64 frames = m_frame.count.load(std::memory_order_relaxed);
+
+    QByteArray out;
+    out += "# render profile " + QDateTime::currentDateTime().toString(Qt::ISODate).toLatin1() + "\n";
+    out += "uptime_s=" + QByteArray::number(seconds, 'f', 1)
+         + " frames=" + QByteArray::number(frames)
+         + " janks=" + QByteArray::number(m_janks.load(std::memory_order_relaxed))
+         + " idle_gaps=" + QByteArray::number(m_idleGaps.load(std::memory_order_relaxed)) + "\n\n";
+
+    m_frame.print(out, "frame");
+    out += "\n";
+    m_sync.print(out, "sync");
+    out += "\n";
+    m_render.print(out, "render");
+    out += "\n";
+
+    QVector<SignalStat> sorted = m_signals;
+    std::sort(sorted.begin(), sorted.end(), [](const SignalStat &a, const SignalStat &b) {
+        return a.evaluations > b.evaluations;
+    });
+
+    out += "signal                   emits  evaluations  per_s\n";
+    for (int i = 0; i < sorted.size(); i++)
+    {
+        const SignalStat &s = sorted.at(i);
+        if (!s.emits)
+            continue;
+
+        out += s.name.leftJustified(22) + " "
+             + QByteArray::number(s.emits).rightJustified(7) + " "
+             + QByteArray::number(s.evaluations).rightJustified(12) + " "
+             + QByteArray::number(seconds > 0 ? s.evaluations / seconds : 0.0, 'f', 1).rightJustified(6) + "\n";
+    }
+
+    return out;
+}
+
+bool RenderProfiler::writeReport()
+{
+    QDir().mkpath(QFileInfo(m_path).absolutePath());
+
+    QSaveFile file(m_path);
+    const QByteArray data = report();
+
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit())
+    {
+        qWarning() << "Render profile write failed:" << file.errorString();
+        return false;
+    }
+    return true;
+}
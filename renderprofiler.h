@@ -0,0 +1,95 @@
+#ifndef RENDERPROFILER_H
+#define RENDERPROFILER_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QHash>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include <atomic>
+
+class QQuickWindow;
+class BLE;
+
+// Render profiling mode, enabled from main() with BLE_PROFILE.
+//
+// Hooks the QQuickWindow frame signals (render thread, direct connections)
+// into frame interval, sync and render histograms, and counts how many
+// binding / handler evaluations each BLE signal causes. The report is
+// rewritten periodically, test phones usually kill the app instead of
+// quitting it.
+class RenderProfiler: public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit RenderProfiler(const QString &reportPath, QObject *parent = 0);
+    ~RenderProfiler();
+
+    void attach(QQuickWindow *window);
+    void watchSignals(BLE *ble);
+
+    QByteArray report() const;
+
+public slots:
+    bool writeReport();
+
+private slots:
+    void beforeSync();
+    void afterSync();
+    void beforeRender();
+    void afterRender();
+    void frameSwapped();
+
+    void countSignal();
+
+private:
+    // 0.5 ms buckets up to 50 ms, the last one collects everything above
+    struct Histogram
+    {
+        enum { Buckets = 101, BucketUs = 500 };
+
+        Histogram();
+
+        void add(qint64 us);
+        qint64 percentile(double p) const;     // us, bucket upper bound
+        void print(QByteArray &out, const char *name) const;
+
+        std::atomic<quint32> buckets[Buckets];
+        std::atomic<quint64> count;
+        std::atomic<quint64> sumUs;
+        std::atomic<qint64> maxUs;
+    };
+
+    struct SignalStat
+    {
+        QByteArray name;
+        QByteArray signature;
+        quint64 emits;
+        quint64 evaluations;
+    };
+
+    QString m_path;
+    QTimer m_reportTimer;
+    QElapsedTimer m_clock;
+
+    // written from the render thread only
+    qint64 m_syncStart;
+    qint64 m_renderStart;
+    qint64 m_lastSwap;
+
+    Histogram m_frame;
+    Histogram m_sync;
+    Histogram m_render;
+    std::atomic<quint64> m_janks;
+    std::atomic<quint64> m_idleGaps;
+
+    BLE *m_ble;
+    QHash<int, int> m_signalRow;
+    QVector<SignalStat> m_signals;
+};
+
+#endif // RENDERPROFILER_H
@@ -0,0 +1,99 @@
+#include "requesttracker.h"
+
+RequestTracker::RequestTracker(QObject *parent):
+    QObject(parent), m_nextId(1)
+{
+    m_clock.start();
+
+    m_timer.setSingleShot(true);
+    connect(&m_timer, SIGNAL(timeout()), this, SLOT(expire()));
+}
+
+int RequestTracker::add(quint8 replyType, quint8 replyCmd, int timeoutMs, const Callback &callback)
+{
+    Request request;
+    request.id = m_nextId++;
+    request.type = replyType;
+    request.cmd = replyCmd;
+    request.deadline = m_clock.elapsed() + timeoutMs;
+    request.callback = callback;
+
+    m_requests.append(request);
+    rearm();
+
+    return request.id;
+}
+
+bool RequestTracker::match(const quint8 *data, int size)
+{
+    if (size < 2)
+        return false;
+
+    for (int i = 0; i < m_requests.size(); i++)
+    {
+        if (m_requests.at(i).type != data[0] || m_requests.at(i).cmd != data[1])
+            continue;
+
+        // taken out first, the callback may add requests
+        const Request request = m_requests.takeAt(i);
+        rearm();
+
+        if (request.callback)
+            request.callback(Replied, QByteArray(reinterpret_cast<const char *>(data), size));
+        return true;
+    }
+    return false;
+}
+
+bool RequestTracker::pending(quint8 replyType, quint8 replyCmd) const
+{
+    for (int i = 0; i < m_requests.size(); i++)
+        if (m_requests.at(i).type == replyType && m_requests.at(i).cmd == replyCmd)
+            return true;
+    return false;
+}
+
+void RequestTracker::cancelAll()
+{
+    const QList<Request> requests = m_requests;
+    m_requests.clear();
+    m_timer.stop();
+
+    for (int i = 0; i < requests.size(); i++)
+        if (requests.at(i).callback)
+            requests.at(i).callback(Cancelled, QByteArray());
+}
+
+void RequestTracker::expire()
+{
+    const qint64 now = m_clock.elapsed();
+
+    QList<Request> expired;
+    for (int i = 0; i < m_requests.size(); )
+    {
+        if (m_requests.at(i).deadline <= now)
+            expired.append(m_requests.takeAt(i));
+        else
+            i++;
+    }
+    rearm();
+
+    for (int i = 0; i < expired.size(); i++)
+        if (expired.at(i).callback)
+            expired.at(i).callback(TimedOut, QByteArray());
+}
+
+void RequestTracker::rearm()
+{
+    if (m_requests.isEmpty())
+    {
+        m_timer.stop();
+        return;
+    }
+
+    qint64 next = m_requests.first().deadline;
+    for (int i = 1; i < m_requests.size(); i++)
+        next = qMin(next, m_requests.at(i).deadline);
+
+    m_timer.start(int(qMax<qint64>(0, next - m_clock.elapsed())));
+}
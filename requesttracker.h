@@ -0,0 +1,64 @@
+#ifndef REQUESTTRACKER_H
+#define REQUESTTRACKER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QList>
+
+#include "linkclock.h"
+
+#include <functional>
+
+// Outstanding request/response exchanges. Each request names the reply it
+// waits for (type, cmd) and gets a callback with the reply, or without one
+// once it timed out or the link went away. Any number can be outstanding;
+// the protocol carries no sequence numbers, so requests waiting for the
+// same reply are answered in the order they were added.
+class RequestTracker: public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Status {
+        Replied,
+        TimedOut,       // the device did not answer in time
+        Cancelled       // dropped with the link, nothing known about the device
+    };
+
+    typedef std::function<void (Status status, const QByteArray &reply)> Callback;
+
+    explicit RequestTracker(QObject *parent = 0);
+
+    int add(quint8 replyType, quint8 replyCmd, int timeoutMs, const Callback &callback);
+
+    // resolves the oldest request waiting for this reply, false if none
+    bool match(const quint8 *data, int size);
+
+    bool pending(quint8 replyType, quint8 replyCmd) const;
+    int outstanding() const { return m_requests.size(); }
+
+    // resolves everything still outstanding as Cancelled
+    void cancelAll();
+
+private slots:
+    void expire();
+
+private:
+    struct Request
+    {
+        int id;
+        quint8 type;
+        quint8 cmd;
+        qint64 deadline;
+        Callback callback;
+    };
+
+    void rearm();
+
+    QList<Request> m_requests;
+    LinkTimer m_timer;
+    LinkElapsedTimer m_clock;
+    int m_nextId;
+};
+
+#endif // REQUESTTRACKER_H
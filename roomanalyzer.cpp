@@ -0,0 +1,468 @@
+#include "roomanalyzer.h"
+#include "simd4.h"
+
+#include <QFile>
+#include <QTextStream>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QtMath>
+
+#include <algorithm>
+
+// 8192 points: 5.9 Hz bins at 48 kHz, enough for the 20 Hz third octave
+#define FFT_ORDER 13
+#define FFT_SIZE (1 << FFT_ORDER)
+
+// third octave band indexes around 1 kHz: 19.7 Hz .. 20.2 kHz
+#define BAND_FIRST -17
+#define BAND_LAST 13
+
+#define FIT_LOW_HZ 40.0
+#define FIT_HIGH_HZ 16000.0
+
+// room nulls are not filled, deeper dips count as this much
+#define DIP_LIMIT_DB 6.0
+
+#define FIT_MAX_SWEEPS 8
+
+// rate the tone stack is modelled at, as in DspEngine
+#define MODEL_RATE 48000.0
+#define SLIDER_STEPS 100
+
+
+struct FftTables
+{
+    QVector<int> reverse;
+    QVector<float> twiddleRe;   // span h at offset h - 1
+    QVector<float> twiddleIm;
+    QVector<float> window;
+};
+
+static FftTables makeTables()
+{
+    FftTables t;
+
+    t.reverse.resize(FFT_SIZE);
+    for (int i = 0; i < FFT_SIZE; i++)
+    {
+        int r = 0;
+        for (int b = 0; b < FFT_ORDER; b++)
+            if (i & (1 << b))
+                r |= 1 << (FFT_ORDER - 1 - b);
+        t.reverse[i] = r;
+    }
+
+    t.twiddleRe.resize(FFT_SIZE);
+    t.twiddleIm.resize(FFT_SIZE);
+    for (int h = 1; h < FFT_SIZE; h <<= 1)
+        for (int k = 0; k < h; k++)
+        {
+            const double a = -M_PI * k / h;
+            t.twiddleRe[h - 1 + k] = float(qCos(a));
+            t.twiddleIm[h - 1 + k] = float(qSin(a));
+        }
+
+    // periodic Hann
+    t.window.resize(FFT_SIZE);
+    for (int n = 0; n < FFT_SIZE; n++)
+        t.window[n] = float(0.5 - 0.5 * qCos(2.0 * M_PI * n / FFT_SIZE));
+
+    return t;
+}
+
+// In place, input already in bit-reversed order. Spans 1 and 2 are scalar,
+// every wider span runs four butterflies per step.
+static void fft(float *re, float *im, const FftTables &t)
+{
+    for (int j = 0; j < FFT_SIZE; j += 2)
+    {
+        const float ar = re[j], ai = im[j], br = re[j + 1], bi = im[j + 1];
+        re[j] = ar + br;
+        im[j] = ai + bi;
+        re[j + 1] = ar - br;
+        im[j + 1] = ai - bi;
+    }
+
+    for (int j = 0; j < FFT_SIZE; j += 4)
+    {
+        float ar = re[j], ai = im[j], br = re[j + 2], bi = im[j + 2];
+        re[j] = ar + br;
+        im[j] = ai + bi;
+        re[j + 2] = ar - br;
+        im[j + 2] = ai - bi;
+
+        // twiddle -i
+        ar = re[j + 1], ai = im[j + 1], br = re[j + 3], bi = im[j + 3];
+        re[j + 1] = ar + bi;
+        im[j + 1] = ai - br;
+        re[j + 3] = ar - bi;
+        im[j + 3] = ai + br;
+    }
+
+    for (int h = 4; h < FFT_SIZE; h <<= 1)
+    {
+        const float *wr = t.twiddleRe.constData() + h - 1;
+        const float *wi = t.twiddleIm.constData() + h - 1;
+
+        for (int j = 0; j < FFT_SIZE; j += 2 * h)
+            for (int k = 0; k < h; k += 4)
+            {
+                float *r0 = re + j + k, *i0 = im + j + k;
+                float *r1 = r0 + h, *i1 = i0 + h;
+
+                const v4f cr = v4_load(wr + k), ci = v4_load(wi + k);
+                const v4f br = v4_load(r1), bi = v4_load(i1);
+                const v4f tr = v4_sub(v4_mul(br, cr), v4_mul(bi, ci));
+                const v4f ti = v4_add(v4_mul(br, ci), v4_mul(bi, cr));
+
+                const v4f ar = v4_load(r0), ai = v4_load(i0);
+                v4_store(r0, v4_add(ar, tr));
+                v4_store(i0, v4_add(ai, ti));
+                v4_store(r1, v4_sub(ar, tr));
+                v4_store(i1, v4_sub(ai, ti));
+            }
+    }
+}
+
+static double bandHz(int band)
+{
+    return 1000.0 * qPow(2.0, (BAND_FIRST + band) / 3.0);
+}
+
+static int &stageValue(DspParams &params, int stage)
+{
+    switch (stage) {
+    case 0:
+        return params.bass;
+    case 1:
+        return params.middle;
+    default:
+        return params.treble;
+    }
+}
+
+// bass and treble carry slider value * 40
+static int stageScale(int stage)
+{
+    return stage == 1 ? 1 : 40;
+}
+
+static double weightedVariance(const double *e, const double *w, int n)
+{
+    double sw = 0, swe = 0, swe2 = 0;
+    for (int i = 0; i < n; i++)
+    {
+        sw += w[i];
+        swe += w[i] * e[i];
+        swe2 += w[i] * e[i] * e[i];
+    }
+    if (sw <= 0)
+        return 0;
+
+    const double mean = swe / sw;
+    return qMax(0.0, swe2 / sw - mean * mean);
+}
+
+static double weightedMean(const double *e, const double *w, int n)
+{
+    double sw = 0, swe = 0;
+    for (int i = 0; i < n; i++)
+    {
+        sw += w[i];
+        swe += w[i] * e[i];
+    }
+    return sw > 0 ? swe / sw : 0;
+}
+
+
+RoomAnalyzer::RoomAnalyzer():
+    m_stimulus(Pink), m_sampleRate(0), m_analysisMs(0)
+{
+}
+
+bool RoomAnalyzer::loadTarget(const QString &path, QString *error)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        if (error)
+            *error = file.errorString();
+        return false;
+    }
+
+    QVector<QPointF> points;
+    QTextStream in(&file);
+    while (!in.atEnd())
+    {
+        const QString line = in.readLine().section('#', 0, 0).trimmed();
+        if (line.isEmpty())
+            continue;
+
+        const QStringList parts = line.split(QRegExp("[\\s,;]+"), QString::SkipEmptyParts);
+        bool okF = false, okDb = false;
+        const double freq = parts.size() == 2 ? parts.at(0).toDouble(&okF) : 0;
+        const double db = parts.size() == 2 ? parts.at(1).toDouble(&okDb) : 0;
+        if (!okF || !okDb || freq <= 0)
+        {
+            if (error)
+                *error = "Bad target line: " + line;
+            return false;
+        }
+        points.append(QPointF(freq, db));
+    }
+
+    std::sort(points.begin(), points.end(), [](const QPointF &a, const QPointF &b) { return a.x() < b.x(); });
+    m_target = points;
+    return true;
+}
+
+double RoomAnalyzer::targetDb(double freq) const
+{
+    if (m_target.isEmpty())
+        return 0;
+    if (freq <= m_target.first().x())
+        return m_target.first().y();
+    if (freq >= m_target.last().x())
+        return m_target.last().y();
+
+    int i = 1;
+    while (m_target.at(i).x() < freq)
+        i++;
+
+    const QPointF &a = m_target.at(i - 1);
+    const QPointF &b = m_target.at(i);
+    const double t = qLn(freq / a.x()) / qLn(b.x() / a.x());
+    return a.y() + t * (b.y() - a.y());
+}
+
+
+//---------------------------------------------------//
+
+bool RoomAnalyzer::analyseWav(const QString &path, QString *error)
+{
+    QVector<float> samples;
+    int channels;
+    double sampleRate;
+    if (!DspEngine::readWav(path, samples, channels, sampleRate, error))
+        return false;
+
+    return analyse(samples, channels, sampleRate, error);
+}
+
+bool RoomAnalyzer::analyse(const QVector<float> &samples, int channels, double sampleRate, QString *error)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    m_bandDb.clear();
+
+    const int frames = channels > 0 ? samples.size() / channels : 0;
+    if (sampleRate <= 0 || frames < FFT_SIZE)
+    {
+        if (error)
+            *error = QString("Recording too short, need at least %1 samples").arg(FFT_SIZE);
+        return false;
+    }
+
+    static const FftTables tables = makeTables();
+
+    QVector<float> mono(frames);
+    const float scale = 1.0f / channels;
+    for (int f = 0; f < frames; f++)
+    {
+        float sum = 0;
+        for (int c = 0; c < channels; c++)
+            sum += samples.at(f * channels + c);
+        mono[f] = sum * scale;
+    }
+
+    QVector<float> re(FFT_SIZE), im(FFT_SIZE), power(FFT_SIZE);
+    QVector<double> average(FFT_SIZE / 2 + 1, 0.0);
+
+    const int hop = FFT_SIZE / 2;
+    const int count = (frames - FFT_SIZE) / hop + 1;
+    const int *reverse = tables.reverse.constData();
+    const float *window = tables.window.constData();
+
+    // two real frames per transform: frame a in the real part, b in the imaginary
+    for (int f = 0; f < count; f += 2)
+    {
+        const float *a = mono.constData() + f * hop;
+        const float *b = f + 1 < count ? a + hop : 0;
+
+        for (int n = 0; n < FFT_SIZE; n++)
+        {
+            re[reverse[n]] = a[n] * window[n];
+            im[reverse[n]] = b ? b[n] * window[n] : 0.0f;
+        }
+
+        fft(re.data(), im.data(), tables);
+
+        for (int k = 0; k < FFT_SIZE; k += 4)
+        {
+            const v4f r = v4_load(re.constData() + k), i = v4_load(im.constData() + k);
+            v4_store(power.data() + k, v4_add(v4_mul(r, r), v4_mul(i, i)));
+        }
+
+        // |A[k]|^2 + |B[k]|^2 == (|Z[k]|^2 + |Z[N - k]|^2) / 2
+        for (int k = 0; k <= FFT_SIZE / 2; k++)
+            average[k] += 0.5 * (double(power.at(k)) + power.at((FFT_SIZE - k) & (FFT_SIZE - 1)));
+    }
+
+    // band power: pink stimulus has equal energy per band, white equal density
+    const double binHz = sampleRate / FFT_SIZE;
+    const double edge = qPow(2.0, 1.0 / 6.0);
+
+    for (int band = 0; band <= BAND_LAST - BAND_FIRST; band++)
+    {
+        const double fc = bandHz(band);
+        const int first = qMax(1, qCeil(fc / edge / binHz));
+        const int last = qMin(FFT_SIZE / 2, qFloor(fc * edge / binHz));
+
+        double density;
+        if (first <= last)
+        {
+            double sum = 0;
+            for (int k = first; k <= last; k++)
+                sum += average.at(k);
+            density = sum / (last - first + 1);
+        }
+        else
+            density = average.at(qBound(1, qRound(fc / binHz), FFT_SIZE / 2));
+
+        const double level = m_stimulus == Pink ? density * fc * (edge - 1.0 / edge) : density;
+        m_bandDb.append(10.0 * std::log10(qMax(level / count, 1e-20)));
+    }
+
+    m_sampleRate = sampleRate;
+    m_analysisMs = timer.nsecsElapsed() / 1e6;
+    return true;
+}
+
+
+//---------------------------------------------------//
+
+RoomCorrection RoomAnalyzer::suggest(const DspParams &current) const
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    RoomCorrection result;
+    result.valid = false;
+    result.params = current;
+    result.rmsBeforeDb = 0;
+    result.rmsAfterDb = 0;
+    result.analysisMs = m_analysisMs;
+
+    const int bands = m_bandDb.size();
+    if (!bands)
+        return result;
+
+    QVector<double> weight(bands), currentStack(bands, 0.0);
+    for (int b = 0; b < bands; b++)
+    {
+        const double f = bandHz(b);
+        result.bandHz.append(f);
+        result.targetDb.append(targetDb(f));
+        weight[b] = f >= FIT_LOW_HZ && f <= FIT_HIGH_HZ && f < m_sampleRate * 0.45 ? 1.0 : 0.0;
+
+        for (int s = 0; s < DspEngine::StageCount; s++)
+            currentStack[b] += DspEngine::magnitudeDb(DspEngine::stageCoeffs(s, current, MODEL_RATE), MODEL_RATE, f);
+    }
+
+    // the level is the volume's business, align the measurement to the target
+    QVector<double> diff(bands);
+    for (int b = 0; b < bands; b++)
+        diff[b] = m_bandDb.at(b) - result.targetDb.at(b);
+    const double level = weightedMean(diff.constData(), weight.constData(), bands);
+
+    // room and speaker alone, relative to the target
+    QVector<double> deviation(bands);
+    for (int b = 0; b < bands; b++)
+        deviation[b] = qMax(diff.at(b) - level, -DIP_LIMIT_DB) - currentStack.at(b);
+
+    // band response of every slider position, per stage
+    QVector<double> table[DspEngine::StageCount];
+    int step[DspEngine::StageCount];
+    DspParams start = current;
+    for (int s = 0; s < DspEngine::StageCount; s++)
+    {
+        DspParams p = current;
+        table[s].resize((SLIDER_STEPS + 1) * bands);
+        for (int v = 0; v <= SLIDER_STEPS; v++)
+        {
+            stageValue(p, s) = v * stageScale(s);
+            const BiquadCoeffs c = DspEngine::stageCoeffs(s, p, MODEL_RATE);
+            for (int b = 0; b < bands; b++)
+                table[s][v * bands + b] = DspEngine::magnitudeDb(c, MODEL_RATE, result.bandHz.at(b));
+        }
+        step[s] = qBound(0, qRound(double(stageValue(start, s)) / stageScale(s)), SLIDER_STEPS);
+    }
+
+    QVector<double> error(bands);
+    for (int b = 0; b < bands; b++)
+        error[b] = deviation.at(b) + currentStack.at(b);
+    result.rmsBeforeDb = qSqrt(weightedVariance(error.constData(), weight.constData(), bands));
+
+    // coordinate descent: the stages barely overlap, a few sweeps settle it
+    QVector<double> base(bands);
+    for (int sweep = 0; sweep < FIT_MAX_SWEEPS; sweep++)
+    {
+        bool moved = false;
+
+        for (int s = 0; s < DspEngine::StageCount; s++)
+        {
+            for (int b = 0; b < bands; b++)
+            {
+                base[b] = deviation.at(b);
+                for (int o = 0; o < DspEngine::StageCount; o++)
+                    if (o != s)
+                        base[b] += table[o].at(step[o] * bands + b);
+            }
+
+            int best = step[s];
+            double bestCost = -1;
+            for (int v = 0; v <= SLIDER_STEPS; v++)
+            {
+                const double *t = table[s].constData() + v * bands;
+                for (int b = 0; b < bands; b++)
+                    error[b] = base.at(b) + t[b];
+
+                const double cost = weightedVariance(error.constData(), weight.constData(), bands);
+                if (bestCost < 0 || cost < bestCost - 1e-9)
+                {
+                    bestCost = cost;
+                    best = v;
+                }
+            }
+
+            if (best != step[s])
+            {
+                step[s] = best;
+                moved = true;
+            }
+        }
+
+        if (!moved)
+            break;
+    }
+
+    for (int s = 0; s < DspEngine::StageCount; s++)
+        stageValue(result.params, s) = step[s] * stageScale(s);
+
+    for (int b = 0; b < bands; b++)
+    {
+        double stack = 0;
+        for (int s = 0; s < DspEngine::StageCount; s++)
+            stack += table[s].at(step[s] * bands + b);
+
+        error[b] = deviation.at(b) + stack;
+        result.measuredDb.append(m_bandDb.at(b) - level);
+        result.correctedDb.append(m_bandDb.at(b) - level - currentStack.at(b) + stack);
+    }
+    result.rmsAfterDb = qSqrt(weightedVariance(error.constData(), weight.constData(), bands));
+
+    result.analysisMs += timer.nsecsElapsed() / 1e6;
+    result.valid = true;
+    return result;
+}
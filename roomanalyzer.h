@@ -0,0 +1,67 @@
+#ifndef ROOMANALYZER_H
+#define ROOMANALYZER_H
+
+#include <QString>
+#include <QVector>
+#include <QPointF>
+
+#include "dspengine.h"
+
+struct RoomCorrection
+{
+    bool valid;
+    DspParams params;           // suggested; on_off and volume as given
+
+    double rmsBeforeDb;         // deviation from the target over the fit range
+    double rmsAfterDb;
+    double analysisMs;
+
+    // per 1/3 octave band, levels aligned to the target
+    QVector<double> bandHz;
+    QVector<double> measuredDb;
+    QVector<double> correctedDb;
+    QVector<double> targetDb;
+};
+
+// Room-correction suggestion from a recorded measurement. The recording is
+// downmixed, Hann windowed and averaged over 50 % overlapping frames
+// (Welch) with a split-complex radix-2 FFT on simd4.h, two real frames per
+// complex transform. Band levels are fitted toward the target curve by
+// coordinate descent over the slider positions of the tone stack, using the
+// same biquads as DspEngine; the overall level is left to the volume.
+//
+// The stimulus is assumed pink (pink noise or a logarithmic sweep) unless
+// set to white (white noise or a linear sweep).
+class RoomAnalyzer
+{
+public:
+    enum Stimulus { Pink, White };
+
+    RoomAnalyzer();
+
+    void setStimulus(Stimulus stimulus) { m_stimulus = stimulus; }
+
+    // (Hz, dB) points interpolated over log frequency, empty is flat
+    void setTarget(const QVector<QPointF> &points) { m_target = points; }
+    // one "<Hz> <dB>" pair per line, '#' starts a comment
+    bool loadTarget(const QString &path, QString *error = 0);
+
+    // interleaved samples as returned by DspEngine::readWav()
+    bool analyse(const QVector<float> &samples, int channels, double sampleRate, QString *error = 0);
+    bool analyseWav(const QString &path, QString *error = 0);
+
+    // the recording was made with `current` on the device
+    RoomCorrection suggest(const DspParams &current) const;
+
+private:
+    double targetDb(double freq) const;
+
+    Stimulus m_stimulus;
+    QVector<QPointF> m_target;
+
+    double m_sampleRate;
+    double m_analysisMs;
+    QVector<double> m_bandDb;
+};
+
+#endif // ROOMANALYZER_H
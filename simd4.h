@@ -0,0 +1,65 @@
+#ifndef SIMD4_H
+#define SIMD4_H
+
+// Minimal 4 x float vector used by the offline DSP code.
+// SSE on x86, NEON on ARM (Android / iOS), plain C++ elsewhere.
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #include <xmmintrin.h>
+    #define SIMD4_SSE 1
+
+    typedef __m128 v4f;
+
+    static inline v4f v4_set1(float a) { return _mm_set1_ps(a); }
+    static inline v4f v4_load(const float *p) { return _mm_loadu_ps(p); }
+    static inline void v4_store(float *p, v4f a) { _mm_storeu_ps(p, a); }
+    static inline v4f v4_add(v4f a, v4f b) { return _mm_add_ps(a, b); }
+    static inline v4f v4_sub(v4f a, v4f b) { return _mm_sub_ps(a, b); }
+    static inline v4f v4_mul(v4f a, v4f b) { return _mm_mul_ps(a, b); }
+
+    // flush-to-zero and denormals-are-zero while in scope
+    struct V4DenormalGuard
+    {
+        V4DenormalGuard(): csr(_mm_getcsr()) { _mm_setcsr(csr | 0x8040); }
+        ~V4DenormalGuard() { _mm_setcsr(csr); }
+        unsigned int csr;
+    };
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define SIMD4_NEON 1
+
+    typedef float32x4_t v4f;
+
+    static inline v4f v4_set1(float a) { return vdupq_n_f32(a); }
+    static inline v4f v4_load(const float *p) { return vld1q_f32(p); }
+    static inline void v4_store(float *p, v4f a) { vst1q_f32(p, a); }
+    static inline v4f v4_add(v4f a, v4f b) { return vaddq_f32(a, b); }
+    static inline v4f v4_sub(v4f a, v4f b) { return vsubq_f32(a, b); }
+    static inline v4f v4_mul(v4f a, v4f b) { return vmulq_f32(a, b); }
+
+    // no portable FPCR access, see SIMD4_ANTI_DENORMAL
+    struct V4DenormalGuard {};
+
+#else
+    struct v4f { float v[4]; };
+
+    static inline v4f v4_set1(float a) { v4f r = {{a, a, a, a}}; return r; }
+    static inline v4f v4_load(const float *p) { v4f r = {{p[0], p[1], p[2], p[3]}}; return r; }
+    static inline void v4_store(float *p, v4f a) { p[0] = a.v[0]; p[1] = a.v[1]; p[2] = a.v[2]; p[3] = a.v[3]; }
+    static inline v4f v4_add(v4f a, v4f b) { v4f r = {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}}; return r; }
+    static inline v4f v4_sub(v4f a, v4f b) { v4f r = {{a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]}}; return r; }
+    static inline v4f v4_mul(v4f a, v4f b) { v4f r = {{a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]}}; return r; }
+
+    struct V4DenormalGuard {};
+#endif
+
+// Without hardware flush-to-zero, a DC offset far below the 24 bit noise
+// floor keeps decaying filter state out of the denormal range.
+#ifdef SIMD4_SSE
+    #define SIMD4_ANTI_DENORMAL 0.0f
+#else
+    #define SIMD4_ANTI_DENORMAL 1e-20f
+#endif
+
+#endif // SIMD4_H
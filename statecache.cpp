@@ -0,0 +1,162 @@
+#include "statecache.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QDebug>
+
+#define STATE_MAGIC 0x424c4553      // "BLES"
+#define STATE_VERSION 2
+
+// quiet time before a write, and the longest a change may stay unwritten
+// while values keep moving (ramps, slider drags)
+#define STATE_DEBOUNCE_MS 500
+#define STATE_MAX_DELAY_MS 3000
+
+
+StateCache::StateCache(QObject *parent):
+    QObject(parent), m_dirty(false)
+{
+    m_path = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/laststate.bin";
+
+    m_timer.setSingleShot(true);
+    connect(&m_timer, SIGNAL(timeout()), this, SLOT(debounce()));
+}
+
+StateCache::~StateCache()
+{
+    flush();
+}
+
+bool StateCache::load(State &state)
+{
+    QFile file(m_path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    const QByteArray data = file.readAll();
+    if (!decode(data, state))
+    {
+        qWarning() << "Ignoring unreadable state cache" << m_path;
+        return false;
+    }
+
+    m_written = data;
+    return true;
+}
+
+// The timer is armed once per burst; debounce() re-arms it for the rest
+// of the quiet time instead of every touch restarting it.
+void StateCache::touch()
+{
+    m_lastTouch.start();
+
+    if (!m_dirty)
+    {
+        m_dirty = true;
+        m_pendingSince.start();
+    }
+
+    if (!m_timer.isActive())
+        m_timer.start(STATE_DEBOUNCE_MS);
+}
+
+void StateCache::debounce()
+{
+    const qint64 quiet = m_lastTouch.elapsed();
+
+    if (quiet < STATE_DEBOUNCE_MS && m_pendingSince.elapsed() < STATE_MAX_DELAY_MS)
+        m_timer.start(qMin<qint64>(STATE_DEBOUNCE_MS - quiet, STATE_MAX_DELAY_MS - m_pendingSince.elapsed()));
+    else
+        flush();
+}
+
+void StateCache::flush()
+{
+    m_timer.stop();
+
+    if (!m_dirty || !m_source)
+        return;
+    m_dirty = false;
+
+    State state;
+    m_source(state);
+
+    const QByteArray data = encode(state);
+    if (data == m_written)
+        return;
+
+    QDir().mkpath(QFileInfo(m_path).absolutePath());
+
+    QSaveFile file(m_path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit())
+    {
+        qWarning() << "State cache write failed:" << file.errorString();
+        return;
+    }
+
+    m_written = data;
+}
+
+//---------------------------------------------------//
+
+QByteArray StateCache::encode(const State &state)
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+
+    out << quint32(STATE_MAGIC) << quint16(STATE_VERSION) << quint8(ParamCount);
+    for (int i = 0; i < ParamCount; i++)
+        out << qint16(state.params[i]);
+    out << quint8(state.style);
+    out << state.serial << state.firmware << state.address << state.name;
+    out << state.configCrc << state.config;
+
+    return data;
+}
+
+bool StateCache::decode(const QByteArray &data, State &state)
+{
+    QDataStream in(data);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic;
+    quint16 version;
+    quint8 count;
+    in >> magic >> version >> count;
+
+    if (in.status() != QDataStream::Ok || magic != STATE_MAGIC || version < 1 || version > STATE_VERSION)
+        return false;
+
+    State s = state;
+
+    // parameters added to the schema later keep their defaults
+    for (int i = 0; i < count; i++)
+    {
+        qint16 value;
+        in >> value;
+        if (i < ParamCount)
+            s.params[i] = value;
+    }
+
+    quint8 style;
+    in >> style;
+    s.style = style;
+
+    in >> s.serial >> s.firmware >> s.address >> s.name;
+
+    s.configCrc = 0;
+    s.config.clear();
+    if (version >= 2)
+        in >> s.configCrc >> s.config;
+
+    if (in.status() != QDataStream::Ok)
+        return false;
+
+    state = s;
+    return true;
+}
@@ -0,0 +1,74 @@
+#ifndef STATECACHE_H
+#define STATECACHE_H
+
+#include "paramschema.h"
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include <functional>
+
+// Last confirmed device state, kept on disk so the UI can show real values
+// before the device answers. touch() only marks the state dirty; it is
+// gathered from the source, encoded and compared when the debounce runs
+// out, and the file is replaced atomically (QSaveFile) only when its
+// content actually changed.
+class StateCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct State
+    {
+        int params[ParamCount];
+        int style;
+        QString serial;
+        QString firmware;
+        QString address;
+        QString name;
+
+        // per-style table of that device, see ConfigSnapshot
+        quint32 configCrc;
+        QByteArray config;
+    };
+
+    explicit StateCache(QObject *parent = 0);
+    ~StateCache();
+
+    void setPath(const QString &path) { m_path = path; }
+    QString path() const { return m_path; }
+
+    // synchronous, meant to run before the QML scene is created
+    bool load(State &state);
+
+    typedef std::function<void(State &)> Source;
+    void setSource(const Source &source) { m_source = source; }
+
+    // cheap enough for every inbound frame, no encoding or timer re-arm
+    void touch();
+
+    static QByteArray encode(const State &state);
+    static bool decode(const QByteArray &data, State &state);
+
+public slots:
+    void flush();
+
+private slots:
+    void debounce();
+
+private:
+    QString m_path;
+    Source m_source;
+
+    QTimer m_timer;
+    QElapsedTimer m_pendingSince;
+    QElapsedTimer m_lastTouch;
+    bool m_dirty;
+
+    QByteArray m_written;
+};
+
+#endif // STATECACHE_H
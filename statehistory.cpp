@@ -0,0 +1,300 @@
+#include "statehistory.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QVariantMap>
+#include <QDebug>
+
+#include <cstring>
+
+#define HISTORY_MAGIC 0x424c4548        // "BLEH"
+#define HISTORY_VERSION 1
+
+// rings start after the header, cache line aligned
+#define HISTORY_HEADER_BYTES 64
+
+static const int capacities[StateHistory::ResolutionCount] = {
+    StateHistory::RawCapacity,
+    StateHistory::SecondCapacity,
+    StateHistory::MinuteCapacity
+};
+
+static const qint64 bucketMs[StateHistory::ResolutionCount] = {
+    0, 1000, 60000
+};
+
+
+StateHistory::StateHistory(const QString &path, QObject *parent):
+    QAbstractListModel(parent), m_base(0), m_header(0), m_resolution(PerSecond)
+{
+    Q_STATIC_ASSERT(sizeof(Header) <= HISTORY_HEADER_BYTES);
+
+    qint64 bytes = HISTORY_HEADER_BYTES;
+    for (int r = 0; r < ResolutionCount; r++)
+        bytes += qint64(capacities[r]) * sizeof(Sample);
+
+    const QString file = path.isEmpty()
+            ? QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/history.bin"
+            : path;
+
+    if (path == QLatin1String(":memory:"))
+    {
+        m_heap.fill(0, int(bytes));
+        m_base = reinterpret_cast<uchar *>(m_heap.data());
+    }
+    else if (!mapFile(file, bytes))
+    {
+        qWarning() << "State history not persistent, cannot map" << file;
+        m_heap.fill(0, int(bytes));
+        m_base = reinterpret_cast<uchar *>(m_heap.data());
+    }
+
+    m_header = reinterpret_cast<Header *>(m_base);
+
+    uchar *p = m_base + HISTORY_HEADER_BYTES;
+    for (int r = 0; r < ResolutionCount; r++)
+    {
+        m_rings[r] = reinterpret_cast<Sample *>(p);
+        p += capacities[r] * sizeof(Sample);
+    }
+
+    bool valid = m_header->magic == HISTORY_MAGIC && m_header->version == HISTORY_VERSION
+              && m_header->paramCount == ParamCount && m_header->sampleSize == sizeof(Sample);
+    for (int r = 0; valid && r < ResolutionCount; r++)
+        valid = m_header->capacity[r] == quint32(capacities[r]) && m_header->size[r] <= m_header->capacity[r]
+             && m_header->head[r] < m_header->capacity[r];
+
+    if (!valid)
+        initHeader();
+}
+
+StateHistory::~StateHistory()
+{
+    if (m_file.isOpen())
+    {
+        m_file.unmap(m_base);
+        m_file.close();
+    }
+}
+
+bool StateHistory::mapFile(const QString &path, qint64 bytes)
+{
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadWrite))
+        return false;
+
+    // a layout change resizes the file, initHeader() then starts it over
+    if (m_file.size() != bytes && !m_file.resize(bytes))
+    {
+        m_file.close();
+        return false;
+    }
+
+    m_base = m_file.map(0, bytes);
+    if (!m_base)
+    {
+        m_file.close();
+        return false;
+    }
+    return true;
+}
+
+void StateHistory::initHeader()
+{
+    memset(m_header, 0, sizeof(Header));
+
+    m_header->magic = HISTORY_MAGIC;
+    m_header->version = HISTORY_VERSION;
+    m_header->paramCount = ParamCount;
+    m_header->sampleSize = sizeof(Sample);
+    for (int r = 0; r < ResolutionCount; r++)
+        m_header->capacity[r] = capacities[r];
+}
+
+//---------------------------------------------------//
+
+StateHistory::Sample &StateHistory::at(Resolution r, int row) const
+{
+    const int capacity = capacities[r];
+    const int oldest = (int(m_header->head[r]) - size(r) + capacity) % capacity;
+    return m_rings[r][(oldest + row) % capacity];
+}
+
+void StateHistory::merge(Sample &s, const int *values, int style, int source)
+{
+    for (int i = 0; i < ParamCount; i++)
+    {
+        const qint16 v = qint16(values[i]);
+        s.last[i] = v;
+        s.minimum[i] = qMin(s.minimum[i], v);
+        s.maximum[i] = qMax(s.maximum[i], v);
+    }
+    s.style = quint8(style);
+    s.source = quint8(source);
+    s.samples++;
+}
+
+void StateHistory::push(Resolution r, qint64 bucketTime, const int *values, int style, int source)
+{
+    const bool shown = r == m_resolution;
+    const bool full = size(r) == capacities[r];
+
+    // a full ring drops its oldest row, the new one reuses that slot
+    if (full)
+    {
+        if (shown)
+            beginRemoveRows(QModelIndex(), 0, 0);
+        m_header->size[r]--;
+        if (shown)
+            endRemoveRows();
+    }
+
+    if (shown)
+        beginInsertRows(QModelIndex(), size(r), size(r));
+
+    Sample &s = m_rings[r][m_header->head[r]];
+    s.time = bucketTime;
+    s.samples = 0;
+    for (int i = 0; i < ParamCount; i++)
+        s.minimum[i] = s.maximum[i] = qint16(values[i]);
+    merge(s, values, style, source);
+
+    m_header->head[r] = (m_header->head[r] + 1) % capacities[r];
+    m_header->size[r]++;
+
+    if (shown)
+    {
+        endInsertRows();
+        if (!full)
+            Q_EMIT countChanged();
+    }
+}
+
+void StateHistory::append(qint64 timeMs, const int *values, int style, int source)
+{
+    for (int r = 0; r < ResolutionCount; r++)
+    {
+        const Resolution res = Resolution(r);
+        const qint64 bucket = bucketMs[r] ? timeMs - timeMs % bucketMs[r] : timeMs;
+
+        if (bucketMs[r] && size(res) > 0 && newest(res).time == bucket)
+        {
+            merge(newest(res), values, style, source);
+
+            if (r == m_resolution)
+            {
+                const QModelIndex last = index(size(res) - 1);
+                Q_EMIT dataChanged(last, last);
+            }
+        }
+        else
+            push(res, bucket, values, style, source);
+    }
+}
+
+void StateHistory::clear()
+{
+    beginResetModel();
+    initHeader();
+    endResetModel();
+    Q_EMIT countChanged();
+}
+
+void StateHistory::setResolution(int resolution)
+{
+    resolution = qBound(0, resolution, int(ResolutionCount) - 1);
+    if (resolution == m_resolution)
+        return;
+
+    beginResetModel();
+    m_resolution = resolution;
+    endResetModel();
+
+    Q_EMIT resolutionChanged();
+    Q_EMIT countChanged();
+}
+
+//---------------------------------------------------//
+
+int StateHistory::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : count();
+}
+
+QVariant StateHistory::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= count())
+        return QVariant();
+
+    const Sample &s = at(Resolution(m_resolution), index.row());
+
+    switch (role) {
+    case TimeRole:
+        return double(s.time);
+    case StyleRole:
+        return int(s.style);
+    case SourceRole:
+        return int(s.source);
+    case SamplesRole:
+        return int(s.samples);
+    default:
+        break;
+    }
+
+    const int param = (role - ParamRole) / 3;
+    if (role < ParamRole || param >= ParamCount)
+        return QVariant();
+
+    switch ((role - ParamRole) % 3) {
+    case 0:
+        return int(s.last[param]);
+    case 1:
+        return int(s.minimum[param]);
+    default:
+        return int(s.maximum[param]);
+    }
+}
+
+QHash<int, QByteArray> StateHistory::roleNames() const
+{
+    QHash<int, QByteArray> roles;
+    roles[TimeRole] = "time";
+    roles[StyleRole] = "style";
+    roles[SourceRole] = "source";
+    roles[SamplesRole] = "samples";
+
+    for (int i = 0; i < ParamCount; i++)
+    {
+        const QByteArray name = ParamSchema::params[i].name;
+        roles[ParamRole + i * 3] = name;
+        roles[ParamRole + i * 3 + 1] = name + "Min";
+        roles[ParamRole + i * 3 + 2] = name + "Max";
+    }
+    return roles;
+}
+
+QVariantList StateHistory::series(const QString &param, int resolution, double fromMs, double toMs) const
+{
+    QVariantList points;
+
+    const int p = ParamSchema::paramByName(param);
+    if (p < 0 || resolution < 0 || resolution >= ResolutionCount)
+        return points;
+
+    const Resolution r = Resolution(resolution);
+    for (int row = 0; row < size(r); row++)
+    {
+        const Sample &s = at(r, row);
+        if (s.time < fromMs || (toMs > 0 && s.time > toMs))
+            continue;
+
+        QVariantMap point;
+        point.insert("x", double(s.time));
+        point.insert("y", int(s.last[p]));
+        points.append(point);
+    }
+    return points;
+}
@@ -0,0 +1,113 @@
+#ifndef STATEHISTORY_H
+#define STATEHISTORY_H
+
+#include "paramschema.h"
+
+#include <QAbstractListModel>
+#include <QFile>
+#include <QByteArray>
+
+// Fixed-size history of received state frames in three rings: every frame
+// (raw), one bucket per second and one per minute. Buckets keep min / max /
+// last of every parameter, so a chart of a whole event stays exact at the
+// extremes. The rings live in a memory-mapped file and survive restarts;
+// if mapping fails they fall back to the heap for the session.
+//
+// As a model it shows one resolution, oldest row first.
+class StateHistory: public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(int resolution READ resolution WRITE setResolution NOTIFY resolutionChanged)
+    Q_PROPERTY(int count READ count NOTIFY countChanged)
+    Q_PROPERTY(bool persistent READ persistent CONSTANT)
+
+public:
+    enum Resolution {
+        Raw,
+        PerSecond,
+        PerMinute,
+        ResolutionCount
+    };
+
+    enum Roles {
+        TimeRole = Qt::UserRole + 1,    // ms since epoch, bucket start
+        StyleRole,
+        SourceRole,                     // frame type: 1 mode, 2 settings echo, 3 style
+        SamplesRole,                    // frames merged into the row
+        ParamRole                       // + param * 3 (+1 min, +2 max)
+    };
+
+    enum {
+        RawCapacity = 4096,
+        SecondCapacity = 3600 * 4,      // four hours
+        MinuteCapacity = 60 * 24 * 7    // a week
+    };
+
+    // empty path: history.bin in the app data dir, ":memory:" keeps it on the heap
+    explicit StateHistory(const QString &path = QString(), QObject *parent = 0);
+    ~StateHistory();
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role) const;
+    QHash<int, QByteArray> roleNames() const;
+
+    int resolution() const { return m_resolution; }
+    void setResolution(int resolution);
+
+    int count() const { return size(Resolution(m_resolution)); }
+    bool persistent() const { return m_file.isOpen(); }
+
+    void append(qint64 timeMs, const int *values, int style, int source);
+
+    // {x: time ms, y: value} points of one parameter for chart series
+    Q_INVOKABLE QVariantList series(const QString &param, int resolution, double fromMs = 0, double toMs = 0) const;
+    Q_INVOKABLE void clear();
+
+signals:
+    void resolutionChanged();
+    void countChanged();
+
+private:
+    struct Header
+    {
+        quint32 magic;
+        quint16 version;
+        quint16 paramCount;
+        quint32 capacity[ResolutionCount];
+        quint32 head[ResolutionCount];      // next slot to write
+        quint32 size[ResolutionCount];
+        quint32 sampleSize;                 // sizeof(Sample), catches layout changes
+    };
+
+    struct Sample
+    {
+        qint64 time;
+        quint32 samples;
+        quint8 style;
+        quint8 source;
+        qint16 last[ParamCount];
+        qint16 minimum[ParamCount];
+        qint16 maximum[ParamCount];
+    };
+
+    bool mapFile(const QString &path, qint64 bytes);
+    void initHeader();
+
+    int size(Resolution r) const { return int(m_header->size[r]); }
+    Sample &at(Resolution r, int row) const;     // row 0 = oldest
+    Sample &newest(Resolution r) const { return at(r, size(r) - 1); }
+
+    void push(Resolution r, qint64 bucketTime, const int *values, int style, int source);
+    void merge(Sample &s, const int *values, int style, int source);
+
+    QFile m_file;
+    QByteArray m_heap;
+    uchar *m_base;
+
+    Header *m_header;
+    Sample *m_rings[ResolutionCount];
+
+    int m_resolution;
+};
+
+#endif // STATEHISTORY_H
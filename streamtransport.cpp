@@ -0,0 +1,256 @@
+#include "streamtransport.h"
+#include "alloctracker.h"
+
+#include <QDebug>
+#include <QUrl>
+#include <QTcpSocket>
+#include <QLocalSocket>
+#include <QHash>
+
+#include <cstring>
+
+#define READ_BUFFER_SIZE 4096
+#define MAX_FRAME_SIZE 255
+
+static QHash<QString, TransportPeer *> s_peers;
+
+
+StreamTransport::StreamTransport(QObject *parent):
+    QObject(parent), m_device(0), m_tcp(0), m_local(0), m_peer(0), m_peerOpen(false), m_fill(0), m_session(0)
+{
+    m_buffer.resize(READ_BUFFER_SIZE);
+
+    // reserved, resize() within the capacity never reallocates
+    m_frame.reserve(MAX_FRAME_SIZE);
+    m_out.reserve(MAX_FRAME_SIZE + 1);
+}
+
+StreamTransport::~StreamTransport()
+{
+    close();
+}
+
+bool StreamTransport::open(const QString &url)
+{
+    close();
+    m_url = url;
+
+    if (url.startsWith("tcp://"))
+    {
+        const QUrl u(url);
+        if (u.host().isEmpty() || u.port() <= 0)
+        {
+            Q_EMIT errorOccurred("Bad transport address " + url);
+            return false;
+        }
+
+        m_tcp = new QTcpSocket(this);
+        m_device = m_tcp;
+
+        connect(m_tcp, SIGNAL(connected()), this, SIGNAL(connected()));
+        connect(m_tcp, SIGNAL(disconnected()), this, SIGNAL(disconnected()));
+        connect(m_tcp, SIGNAL(readyRead()), this, SLOT(readFrames()));
+        connect(m_tcp, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(socketError()));
+
+        m_tcp->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        m_tcp->connectToHost(u.host(), quint16(u.port()));
+        return true;
+    }
+
+    if (url.startsWith("sim:"))
+    {
+        m_peer = s_peers.value(url.mid(4));
+        if (!m_peer)
+        {
+            Q_EMIT errorOccurred("No simulated peer " + url);
+            return false;
+        }
+
+        m_peer->attach(this);
+        return true;
+    }
+
+    QString name;
+    if (url.startsWith("unix:"))
+        name = url.mid(5);
+    else if (url.startsWith("local:"))
+        name = url.mid(6);
+    else
+    {
+        Q_EMIT errorOccurred("Unknown transport " + url);
+        return false;
+    }
+
+    m_local = new QLocalSocket(this);
+    m_device = m_local;
+
+    connect(m_local, SIGNAL(connected()), this, SIGNAL(connected()));
+    connect(m_local, SIGNAL(disconnected()), this, SIGNAL(disconnected()));
+    connect(m_local, SIGNAL(readyRead()), this, SLOT(readFrames()));
+    connect(m_local, SIGNAL(error(QLocalSocket::LocalSocketError)), this, SLOT(socketError()));
+
+    m_local->connectToServer(name);
+    return true;
+}
+
+void StreamTransport::close()
+{
+    if (m_tcp)
+    {
+        m_tcp->disconnect(this);
+        m_tcp->abort();
+        m_tcp->deleteLater();
+        m_tcp = 0;
+    }
+
+    if (m_local)
+    {
+        m_local->disconnect(this);
+        m_local->abort();
+        m_local->deleteLater();
+        m_local = 0;
+    }
+
+    if (m_peer)
+    {
+        TransportPeer *peer = m_peer;
+        m_peer = 0;
+        m_peerOpen = false;
+        peer->detach(this);
+    }
+
+    m_device = 0;
+    m_fill = 0;
+    m_session++;
+}
+
+bool StreamTransport::isOpen() const
+{
+    if (m_peer)
+        return m_peerOpen;
+    if (m_tcp)
+        return m_tcp->state() == QAbstractSocket::ConnectedState;
+    if (m_local)
+        return m_local->state() == QLocalSocket::ConnectedState;
+    return false;
+}
+
+bool StreamTransport::write(const QByteArray &frame)
+{
+    if (!isOpen() || frame.isEmpty() || frame.size() > MAX_FRAME_SIZE)
+        return false;
+
+    if (m_peer)
+    {
+        m_peer->receive(this, frame);
+        return true;
+    }
+
+    m_out.resize(1 + frame.size());
+    m_out[0] = char(frame.size());
+    memcpy(m_out.data() + 1, frame.constData(), frame.size());
+
+    // non-blocking: the socket queues the bytes and flushes from the event loop
+    ALLOC_EXCLUDE();
+    m_device->write(m_out.constData(), m_out.size());
+    return true;
+}
+
+int StreamTransport::frameLength(const char *data, int available)
+{
+    if (available < 1)
+        return -1;
+
+    const int length = quint8(data[0]);
+    return available >= 1 + length ? length : -1;
+}
+
+void StreamTransport::readFrames()
+{
+    const quint32 session = m_session;
+
+    while (m_device && m_device->bytesAvailable() > 0)
+    {
+        if (m_fill == m_buffer.size())
+            m_buffer.resize(m_buffer.size() * 2);
+
+        qint64 got;
+        {
+            ALLOC_EXCLUDE();
+            got = m_device->read(m_buffer.data() + m_fill, m_buffer.size() - m_fill);
+        }
+        if (got <= 0)
+            break;
+        m_fill += int(got);
+
+        // hand out every complete frame
+        const char *p = m_buffer.constData();
+        int pos = 0;
+        int length;
+        while ((length = frameLength(p + pos, m_fill - pos)) >= 0)
+        {
+            if (length > 0)
+            {
+                ALLOC_PROBE(Inbound);
+
+                m_frame.resize(length);
+                memcpy(m_frame.data(), p + pos + 1, length);
+                Q_EMIT frameReceived(m_frame);
+
+                // a receiver closed or reopened the transport, the buffer is gone
+                if (m_session != session)
+                    return;
+            }
+            pos += 1 + length;
+        }
+
+        if (pos > 0)
+        {
+            m_fill -= pos;
+            memmove(m_buffer.data(), m_buffer.constData() + pos, m_fill);
+        }
+    }
+}
+
+void StreamTransport::registerPeer(const QString &name, TransportPeer *peer)
+{
+    if (peer)
+        s_peers.insert(name, peer);
+    else
+        s_peers.remove(name);
+}
+
+void StreamTransport::peerConnected()
+{
+    if (!m_peer || m_peerOpen)
+        return;
+
+    m_peerOpen = true;
+    Q_EMIT connected();
+}
+
+void StreamTransport::peerDisconnected()
+{
+    if (!m_peer)
+        return;
+
+    m_peer = 0;
+    m_peerOpen = false;
+    Q_EMIT disconnected();
+}
+
+void StreamTransport::peerFrame(const QByteArray &frame)
+{
+    if (!m_peerOpen)
+        return;
+
+    ALLOC_PROBE(Inbound);
+    Q_EMIT frameReceived(frame);
+}
+
+void StreamTransport::socketError()
+{
+    const QString error = m_device ? m_device->errorString() : QString();
+    qWarning() << "transport error:" << m_url << error;
+    Q_EMIT errorOccurred(error);
+}
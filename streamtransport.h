@@ -0,0 +1,88 @@
+#ifndef STREAMTRANSPORT_H
+#define STREAMTRANSPORT_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QString>
+
+class QIODevice;
+class QTcpSocket;
+class QLocalSocket;
+class StreamTransport;
+
+// In-process peer behind a sim:name address (LinkSimulation). Frames written
+// to the transport go to receive(); the peer answers through
+// StreamTransport::peerFrame() and reports the link with peerConnected() /
+// peerDisconnected(), never from inside attach() or receive().
+class TransportPeer
+{
+public:
+    virtual ~TransportPeer() {}
+
+    virtual void attach(StreamTransport *transport) = 0;
+    virtual void detach(StreamTransport *transport) = 0;
+    virtual void receive(StreamTransport *transport, const QByteArray &frame) = 0;
+};
+
+// Byte-stream backend for the same frames BLE writes to 0xffe1 and
+// receives as notifications: TCP (Wi-Fi attached ESP32), a local socket
+// (stand-in process, broker) or an in-process TransportPeer (simulation).
+// On the sockets each frame is prefixed with its length byte.
+//
+// Reads land directly in one reusable buffer; each complete frame is
+// copied into a second reserved buffer for frameReceived(), so a steady
+// stream of frames does not touch the heap on either side.
+class StreamTransport: public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit StreamTransport(QObject *parent = 0);
+    ~StreamTransport();
+
+    // tcp://host:port, unix:/path/to/socket, local:name or sim:name
+    bool open(const QString &url);
+    void close();
+
+    bool isOpen() const;
+    QString url() const { return m_url; }
+
+    bool write(const QByteArray &frame);
+
+    // length-prefixed framing shared with DeviceStandIn and the broker
+    static int frameLength(const char *data, int available);
+
+    // sim:name peers, 0 removes
+    static void registerPeer(const QString &name, TransportPeer *peer);
+
+    void peerConnected();
+    void peerDisconnected();
+    void peerFrame(const QByteArray &frame);
+
+signals:
+    void connected();
+    void disconnected();
+    void frameReceived(const QByteArray &frame);
+    void errorOccurred(const QString &error);
+
+private slots:
+    void readFrames();
+    void socketError();
+
+private:
+    QString m_url;
+    QIODevice *m_device;
+    QTcpSocket *m_tcp;
+    QLocalSocket *m_local;
+    TransportPeer *m_peer;
+    bool m_peerOpen;
+
+    QByteArray m_buffer;
+    int m_fill;
+    quint32 m_session;      // bumped by close(), ends a readFrames() loop
+
+    QByteArray m_frame;     // current inbound frame
+    QByteArray m_out;       // length byte + outbound frame
+};
+
+#endif // STREAMTRANSPORT_H